@@ -1,8 +1,13 @@
 #pragma once
 
 #include <asio_utp/log.hpp>
+#include <asio_utp/options.hpp>
+#include <asio_utp/chunk.hpp>
+#include <asio_utp/connect.hpp>
+#include <asio_utp/connection_pool.hpp>
 #include <asio_utp/socket.hpp>
 #include <asio_utp/protocol.hpp>
+#include <asio_utp/stream_multiplexer.hpp>
 #include <asio_utp/udp_multiplexer.hpp>
 
 namespace asio_utp {
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <boost/asio/buffer.hpp>
+#include <cassert>
+
+namespace asio_utp {
+
+namespace detail { class chunk_pool; }
+
+// A read only piece of received data owned by the library. Copies share the
+// same memory, which goes back to the context's pool once the last copy
+// referencing it is gone.
+class chunk {
+public:
+    chunk() = default;
+
+    chunk(const chunk&);
+    chunk& operator=(const chunk&);
+
+    chunk(chunk&&);
+    chunk& operator=(chunk&&);
+
+    const unsigned char* data() const {
+        if (!_block) return nullptr;
+        return reinterpret_cast<const unsigned char*>(_block + 1) + _begin;
+    }
+
+    size_t size() const { return _end - _begin; }
+
+    // Removes `n` bytes from the front of this view.
+    void consume(size_t n) {
+        assert(n <= size());
+        _begin += n;
+    }
+
+    operator boost::asio::const_buffer() const {
+        return boost::asio::const_buffer(data(), size());
+    }
+
+    ~chunk();
+
+private:
+    friend class detail::chunk_pool;
+
+    // Followed in memory by `capacity` bytes of data.
+    struct block {
+        size_t refcount;
+        size_t capacity;
+        detail::chunk_pool* pool;
+        block* next;
+    };
+
+    chunk(block*, size_t size);
+
+    void release();
+
+private:
+    block* _block = nullptr;
+    size_t _begin = 0;
+    size_t _end = 0;
+};
+
+} // namespace
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <asio_utp/socket.hpp>
+#include <chrono>
+#include <vector>
+
+namespace asio_utp {
+
+namespace detail {
+    void do_connect_any( socket&
+                       , std::vector<socket::endpoint_type>
+                       , std::chrono::milliseconds stagger
+                       , handler<socket::endpoint_type>&&);
+}
+
+// Default delay between starting connection attempts in `async_connect_any`
+// (same as recommended for TCP by RFC 8305).
+static const std::chrono::milliseconds connect_any_stagger{250};
+
+// Connects `s` to the first of `endpoints` that answers. Attempts are started
+// in order, one every `stagger` or as soon as the previous one failed, all
+// from the local endpoint `s` is bound to (so they go through the same libutp
+// context). Once one of them connects, the others are closed and `s` takes
+// over the winning connection. Completes with the endpoint that won, or the
+// error of the last attempt if they all failed.
+//
+// Because libutp doesn't retransmit SYNs, an attempt to a dead address never
+// fails on its own. Closing or destroying `s` aborts the whole operation
+// (noticed within one `stagger` interval), so it can be bounded by a timer.
+// If `s` is moved meanwhile, the socket it was moved to takes over.
+template< typename EndpointSequence
+        , typename CompletionToken>
+inline
+auto async_connect_any( socket& s
+                      , const EndpointSequence& endpoints
+                      , std::chrono::milliseconds stagger
+                      , CompletionToken&& token)
+{
+    std::vector<socket::endpoint_type> eps(std::begin(endpoints), std::end(endpoints));
+
+    return boost::asio::async_initiate
+        < CompletionToken
+        , void(boost::system::error_code, socket::endpoint_type)
+        >([&s, eps = std::move(eps), stagger] (auto h) mutable {
+            detail::do_connect_any( s
+                                  , std::move(eps)
+                                  , stagger
+                                  , {s.get_executor(), std::move(h)});
+          }, token);
+}
+
+template< typename EndpointSequence
+        , typename CompletionToken>
+inline
+auto async_connect_any( socket& s
+                      , const EndpointSequence& endpoints
+                      , CompletionToken&& token)
+{
+    return async_connect_any( s
+                            , endpoints
+                            , connect_any_stagger
+                            , std::forward<CompletionToken>(token));
+}
+
+} // namespace
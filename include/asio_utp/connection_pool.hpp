@@ -0,0 +1,118 @@
+#pragma once
+
+#include <asio_utp/socket.hpp>
+#include <asio_utp/udp_multiplexer.hpp>
+#include <chrono>
+#include <list>
+#include <map>
+
+namespace asio_utp {
+
+// Keeps connected sockets that are no longer in use around, keyed by their
+// remote endpoint, so that the next connection to the same peer skips the
+// handshake and starts with an already opened congestion window.
+//
+// All sockets share the pool's UDP multiplexer (and thus one libutp
+// context). A socket may only be given back with `release` when the
+// protocol running over it is at a point where the next user can start
+// afresh (e.g. between a response and the next request). Idle sockets are
+// checked before being handed out: one which got closed, received an EOF or
+// unexpected data, or sat idle for longer than `max_idle_time` is dropped.
+class connection_pool {
+public:
+    using endpoint_type = boost::asio::ip::udp::endpoint;
+    using executor_type = boost::asio::executor;
+    using clock = std::chrono::steady_clock;
+
+    struct limits {
+        // Idle sockets kept per remote endpoint, and in total. When full,
+        // the ones idle for the longest time are closed first.
+        size_t max_idle_per_peer = 4;
+        size_t max_idle = 1024;
+
+        clock::duration max_idle_time = std::chrono::seconds(60);
+
+        // Libutp doesn't retransmit SYNs, so a connect to a peer which doesn't
+        // answer would never complete. After this long `async_get` fails with
+        // `timed_out` instead. Zero means no timeout.
+        clock::duration connect_timeout = std::chrono::seconds(10);
+    };
+
+public:
+    connection_pool(const executor_type&);
+    connection_pool(const executor_type&, const limits&);
+
+    connection_pool(const connection_pool&) = delete;
+    connection_pool& operator=(const connection_pool&) = delete;
+
+    ~connection_pool();
+
+    void bind(const endpoint_type&, boost::system::error_code&);
+
+    endpoint_type local_endpoint() const;
+
+    // Completes with a connected socket: an idle one if there is one for the
+    // endpoint (the handler is then posted right away), a newly connected
+    // one otherwise.
+    template<typename CompletionToken>
+    auto async_get(const endpoint_type&, CompletionToken&&);
+
+    // Gives a socket obtained from `async_get` back to the pool.
+    void release(socket&&);
+
+    size_t idle_count() const { return _idle.size(); }
+
+    size_t idle_count(const endpoint_type&) const;
+
+    // Closes all idle sockets and aborts the connects in progress, their
+    // `async_get` completes with `operation_aborted`.
+    void close();
+
+    executor_type get_executor() const
+    {
+        return _ex;
+    }
+
+private:
+    struct idle_socket {
+        endpoint_type remote;
+        clock::time_point since;
+        socket s;
+    };
+
+    using idle_list = std::list<idle_socket>;
+
+    struct connecting;
+
+    void do_get(const endpoint_type&, handler<socket>&&);
+
+    bool take_idle(const endpoint_type&, socket&);
+    void erase(idle_list::iterator);
+
+    static bool is_reusable(socket&);
+
+private:
+    executor_type _ex;
+    limits _limits;
+    udp_multiplexer _multiplexer;
+
+    // Least recently released first.
+    idle_list _idle;
+    std::map<endpoint_type, std::list<idle_list::iterator>> _by_peer;
+
+    std::list<std::shared_ptr<connecting>> _connecting;
+};
+
+template<typename CompletionToken>
+inline
+auto connection_pool::async_get(const endpoint_type& ep, CompletionToken&& token)
+{
+    return boost::asio::async_initiate
+        < CompletionToken
+        , void(boost::system::error_code, socket)
+        >([this, ep] (auto h) {
+            do_get(ep, {get_executor(), std::move(h)});
+          }, token);
+}
+
+} // namespace
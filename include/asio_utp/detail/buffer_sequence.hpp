@@ -0,0 +1,120 @@
+#pragma once
+
+#include <boost/asio/buffer.hpp>
+#include <array>
+#include <iterator>
+#include <type_traits>
+#include <vector>
+
+namespace asio_utp { namespace detail {
+
+// Holds a copy of the user's buffer sequence for the duration of an
+// operation. A single buffer, or a sequence of up to `N` buffers, is stored
+// inline; only longer sequences go through the (reused) heap storage.
+//
+// `Buffer` is either `boost::asio::const_buffer` or `mutable_buffer`.
+template<class Buffer, size_t N = 8>
+class buffer_sequence {
+public:
+    using value_type = Buffer;
+    using iterator = Buffer*;
+    using const_iterator = const Buffer*;
+
+public:
+    buffer_sequence() = default;
+
+    buffer_sequence(const buffer_sequence& other)
+    {
+        *this = other;
+    }
+
+    buffer_sequence& operator=(const buffer_sequence& other)
+    {
+        if (this == &other) return *this;
+
+        if (other._begin == other._inline.data()) {
+            _inline = other._inline;
+            _begin = _inline.data();
+        } else {
+            _heap = other._heap;
+            _begin = _heap.data();
+        }
+
+        _size = other._size;
+        return *this;
+    }
+
+    // Single buffers (including the `mutable_buffers_1` and
+    // `const_buffers_1` types returned by `boost::asio::buffer`) don't need
+    // a sequence walk.
+    template<class Sequence>
+    std::enable_if_t<std::is_convertible<const Sequence&, Buffer>::value>
+    assign(const Sequence& b)
+    {
+        _inline[0] = Buffer(b);
+        _begin = _inline.data();
+        _size = 1;
+    }
+
+    template<class Sequence>
+    std::enable_if_t<!std::is_convertible<const Sequence&, Buffer>::value>
+    assign(const Sequence& bufs)
+    {
+        auto first = boost::asio::buffer_sequence_begin(bufs);
+        auto last  = boost::asio::buffer_sequence_end(bufs);
+
+        size_t n = std::distance(first, last);
+
+        if (n <= N) {
+            std::copy(first, last, _inline.begin());
+            _begin = _inline.data();
+        } else {
+            _heap.assign(first, last);
+            _begin = _heap.data();
+        }
+
+        _size = n;
+    }
+
+    // Same as above, with `first` in front of the sequence.
+    template<class Sequence>
+    void assign(const Buffer& first, const Sequence& bufs)
+    {
+        auto begin = boost::asio::buffer_sequence_begin(bufs);
+        auto end   = boost::asio::buffer_sequence_end(bufs);
+
+        size_t n = std::distance(begin, end) + 1;
+
+        if (n <= N) {
+            _begin = _inline.data();
+        } else {
+            _heap.resize(n);
+            _begin = _heap.data();
+        }
+
+        _begin[0] = first;
+        std::copy(begin, end, _begin + 1);
+
+        _size = n;
+    }
+
+    void clear() { _size = 0; }
+
+    // Mutable access lets the implementation consume the buffers in place.
+    Buffer* begin() { return _begin; }
+    Buffer* end()   { return _begin + _size; }
+
+    const Buffer* begin() const { return _begin; }
+    const Buffer* end()   const { return _begin + _size; }
+
+    size_t size() const { return _size; }
+    bool empty() const { return _size == 0; }
+
+private:
+    std::array<Buffer, N> _inline;
+    std::vector<Buffer> _heap;
+    Buffer* _begin = _inline.data();
+    size_t _size = 0;
+};
+
+}} // namespaces
@@ -1,70 +1,204 @@
 #pragma once
 
+#include <boost/asio/associated_allocator.hpp>
+#include <boost/asio/associated_executor.hpp>
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/system/error_code.hpp>
+#include <cassert>
+#include <functional>
+#include <memory>
+#include <tuple>
+#include <utility>
+
 namespace asio_utp {
 
+namespace detail {
+
+// A single block of memory an I/O object keeps around for the type-erased
+// state of its handlers, so that back to back operations of the same kind
+// don't go through the allocator each time.
+class handler_memory {
+public:
+    handler_memory() = default;
+
+    handler_memory(const handler_memory&) = delete;
+    handler_memory& operator=(const handler_memory&) = delete;
+
+    void* allocate(size_t size)
+    {
+        if (_in_use) return ::operator new(size);
+
+        if (_size < size) {
+            ::operator delete(_data);
+            _data = nullptr;
+            _data = ::operator new(size);
+            _size = size;
+        }
+
+        _in_use = true;
+        return _data;
+    }
+
+    void deallocate(void* p)
+    {
+        if (p == _data) {
+            _in_use = false;
+            return;
+        }
+
+        ::operator delete(p);
+    }
+
+    ~handler_memory()
+    {
+        assert(!_in_use);
+        ::operator delete(_data);
+    }
+
+private:
+    void* _data = nullptr;
+    size_t _size = 0;
+    bool _in_use = false;
+};
+
+// Called right after the completion handler has been invoked. Unlike
+// std::function this never allocates, the whole state is one shared pointer.
+struct after_hook {
+    using function_type = void(*)(const std::shared_ptr<void>&, const char*);
+
+    function_type func = nullptr;
+    std::shared_ptr<void> arg;
+    const char* dbg = nullptr;
+
+    void operator()() const { if (func) func(arg, dbg); }
+};
+
+} // detail namespace
+
 template<typename... Args>
 class handler {
 private:
     using error_code = boost::system::error_code;
 
     struct base {
+        // Both `post` and `dispatch` destroy `this`.
         virtual void post(const error_code&, Args...) = 0;
         virtual void dispatch(const error_code&, Args...) = 0;
-        virtual void exec_after(std::function<void()>) = 0;
-        virtual ~base() {};
+        virtual void exec_after(detail::after_hook) = 0;
+        virtual void destroy() = 0;
+    protected:
+        ~base() {};
+    };
+
+    struct deleter {
+        void operator()(base* b) const { b->destroy(); }
     };
 
+    // Binds the completion arguments to the function without going through
+    // std::bind and runs the `after` hook once the function returns.
+    template<class Func>
+    struct binder {
+        Func f;
+        detail::after_hook after;
+        error_code ec;
+        std::tuple<Args...> args;
+
+        void operator()()
+        {
+            invoke(std::index_sequence_for<Args...>());
+        }
+
+        template<size_t... I>
+        void invoke(std::index_sequence<I...>)
+        {
+            f(ec, std::move(std::get<I>(args))...);
+            after();
+        }
+    };
+
+    template<class Impl, class Allocator>
+    static void* allocate(const Allocator& a, detail::handler_memory* m)
+    {
+        if (m && std::is_same<Allocator, std::allocator<void>>::value) {
+            return m->allocate(sizeof(Impl));
+        }
+
+        typename std::allocator_traits<Allocator>
+            ::template rebind_alloc<Impl> ia(a);
+
+        return ia.allocate(1);
+    }
+
+    template<class Impl, class Allocator>
+    static void deallocate(Impl* p, const Allocator& a, detail::handler_memory* m)
+    {
+        if (m && std::is_same<Allocator, std::allocator<void>>::value) {
+            return m->deallocate(p);
+        }
+
+        typename std::allocator_traits<Allocator>
+            ::template rebind_alloc<Impl> ia(a);
+
+        ia.deallocate(p, 1);
+    }
+
     template<class Executor, class Allocator, class Func>
     struct impl final : public base {
         Executor e;
         Allocator a;
         Func f;
         boost::asio::executor_work_guard<Executor> w;
-        std::function<void()> after;
+        detail::after_hook after;
+        detail::handler_memory* m;
 
         template<class E, class A, class F>
-        impl(E&& e, A&& a, F&& f)
+        impl(E&& e, A&& a, F&& f, detail::handler_memory* m)
             : e(std::forward<E>(e))
             , a(std::forward<A>(a))
             , f(std::forward<F>(f))
             , w(this->e)
+            , m(m)
         {}
 
+        // Moves the function out and releases the memory of `this` before
+        // the function is handed over to the executor.
+        binder<Func> release(const error_code& ec, Args... args)
+        {
+            binder<Func> b{ std::move(f)
+                          , std::move(after)
+                          , ec
+                          , std::tuple<Args...>(std::move(args)...) };
+            destroy();
+            return b;
+        }
+
         void post(const error_code& ec, Args... args) override
         {
-            if (!after) {
-                e.post(std::bind(std::move(f), ec, args...), a);
-            } else {
-                auto ff =
-                    [f = std::move(f), after = std::move(after)]
-                    (const error_code& ec, auto... args) mutable {
-                        f(ec, args...);
-                        after();
-                    };
-
-                e.post(std::bind(std::move(ff), ec, args...), a);
-            }
+            auto e = std::move(this->e);
+            auto a = this->a;
+            auto w = std::move(this->w);
+            e.post(release(ec, std::move(args)...), a);
         }
 
         void dispatch(const error_code& ec, Args... args) override
         {
-            if (!after) {
-                e.dispatch(std::bind(std::move(f), ec, args...), a);
-            } else {
-                auto ff =
-                    [f = std::move(f), after = std::move(after)]
-                    (const error_code& ec, auto... args) mutable {
-                        f(ec, args...);
-                        after();
-                    };
-
-                e.dispatch(std::bind(std::move(ff), ec, args...), a);
-            }
+            auto e = std::move(this->e);
+            auto a = this->a;
+            auto w = std::move(this->w);
+            e.dispatch(release(ec, std::move(args)...), a);
         }
 
-        void exec_after(std::function<void()> f) override
+        void exec_after(detail::after_hook h) override
         {
-            after = std::move(f);
+            after = std::move(h);
+        }
+
+        void destroy() override
+        {
+            auto a = this->a;
+            auto m = this->m;
+            this->~impl();
+            deallocate(this, a, m);
         }
     };
 
@@ -74,7 +208,10 @@ public:
     handler(handler&& h) = default;
     handler& operator=(handler&& h) = default;
 
-    template<class Executor, class Func> handler(Executor&& exec, Func&& func)
+    // If the handler has no allocator associated with it, its state is kept
+    // in `mem` (when given and not already in use).
+    template<class Executor, class Func>
+    handler(Executor&& exec, Func&& func, detail::handler_memory* mem = nullptr)
     {
         namespace net = boost::asio;
 
@@ -84,32 +221,32 @@ public:
                    ( func
                    , std::allocator<void>());
 
-        using impl_t = impl<decltype(e), decltype(a), Func>;
+        using impl_t = impl<decltype(e), decltype(a), std::decay_t<Func>>;
+
+        void* p = allocate<impl_t>(a, mem);
 
-        // XXX: allocate `impl` using `a`
-        _impl = std::make_unique<impl_t>( std::move(e)
-                                        , std::move(a)
-                                        , std::forward<Func>(func));
+        _impl.reset(new (p) impl_t( std::move(e)
+                                  , std::move(a)
+                                  , std::forward<Func>(func)
+                                  , mem));
     }
 
     void post(const error_code& ec, Args... args) {
-        auto i = std::move(_impl);
-        i->post(ec, args...);
+        _impl.release()->post(ec, std::move(args)...);
     }
 
     void dispatch(const error_code& ec, Args... args) {
-        auto i = std::move(_impl);
-        i->dispatch(ec, args...);
+        _impl.release()->dispatch(ec, std::move(args)...);
     }
 
-    void exec_after(std::function<void()> f) {
-        _impl->exec_after(std::move(f));
+    void exec_after(detail::after_hook h) {
+        _impl->exec_after(std::move(h));
     }
 
     operator bool() const { return bool(_impl); }
 
 private:
-    std::unique_ptr<base> _impl;
+    std::unique_ptr<base, deleter> _impl;
 };
 
 } // namespace
@@ -75,6 +75,8 @@ public:
 
     size_t size() const { return _connections.size(); }
 
+    bool empty() const { return _connections.empty(); }
+
 private:
     List<Connection> _connections;
 };
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <chrono>
+
+namespace asio_utp {
+
+namespace detail {
+
+// A typed value passed to `socket::set_option` and `socket::get_option`. The
+// `Tag` type only serves to make each option a distinct type.
+template<class Tag, class T>
+class option {
+public:
+    using value_type = T;
+
+public:
+    option() = default;
+    explicit option(T value) : _value(value) {}
+
+    T value() const { return _value; }
+
+private:
+    T _value{};
+};
+
+} // detail namespace
+
+// Similar to TCP_CORK: while enabled, writes are accumulated in the socket and
+// only handed over to libutp once enough data has been gathered to fill
+// several full size packets, or when the socket is uncorked or flushed.
+using cork = detail::option<struct cork_tag, bool>;
+
+// If non zero, small writes are held back for at most this long in the hope
+// they can be merged with the ones following them. Also bounds the time data
+// may stay in the socket while it is corked.
+using coalesce_delay
+    = detail::option<struct coalesce_delay_tag, std::chrono::milliseconds>;
+
+// When enabled, a read that can be satisfied from data the socket has already
+// received completes through the handler's executor `dispatch` instead of
+// `post`. That is, the handler may run before `async_read_some` returns.
+// A coroutine awaiting such a read (`asio::use_awaitable`) is then resumed
+// right away instead of going through the executor's queue. Handlers that
+// start the next read from within nest on the stack, so after 16 reads in a
+// row completed this way the next one is posted.
+using immediate_completion = detail::option<struct immediate_completion_tag, bool>;
+
+// Largest message `socket::async_receive_message` accepts. A peer announcing
+// a bigger one is considered broken: the receive fails with `message_size`
+// and the socket is closed.
+using max_message_size = detail::option<struct max_message_size_tag, size_t>;
+
+// For protocols where the accepting side talks first. Libutp doesn't let an
+// accepted socket send before it received data, so with this enabled the
+// connecting socket sends one extra byte as soon as the handshake completes
+// and the accepting socket drops it, after which writes issued right after
+// `async_accept` go out. Must be set on both ends (before `async_connect` and
+// `async_accept` respectively), otherwise the byte shows up in the stream.
+using server_first = detail::option<struct server_first_tag, bool>;
+
+// How long the metrics remembered about a peer address (`path_metrics`)
+// stay valid after their last update. Shared by all sockets bound to the
+// same local endpoint.
+using path_metrics_expiry
+    = detail::option<struct path_metrics_expiry_tag, std::chrono::seconds>;
+
+// By default the acknowledgements for received data go out after every
+// burst of packets read from the UDP socket, which on bulk transfers is close
+// to one per data packet. With `ack_frequency` set to N, they are sent once N
+// data packets are unacknowledged, or when the oldest of them waited for
+// `max_ack_delay`. A packet arriving out of order is acknowledged right away
+// so the sender learns about losses without delay. The delay should stay
+// well below the RTT: a sender whose window is smaller than N packets waits
+// for it every round trip. Shared by all sockets bound to the same local
+// endpoint (libutp sends acknowledgements per context).
+using ack_frequency = detail::option<struct ack_frequency_tag, size_t>;
+using max_ack_delay
+    = detail::option<struct max_ack_delay_tag, std::chrono::milliseconds>;
+
+// Forward error correction for lossy links. When non zero, every that many
+// uTP data packets the socket sends are followed by a parity packet (their
+// XOR), from which the receiving context rebuilds any single one of them that
+// got lost before libutp notices the loss. A group still open 10ms after its
+// last packet gets its parity then, if it holds at least two packets (a lone
+// packet waits for the next ones). Costs 4 bytes per data packet on top
+// of the parity packets. Must be enabled on both ends, the frames are only
+// used once the peer announced it understands them (which it does along with
+// the handshake). At most 255, 0 (off) by default.
+using forward_error_correction
+    = detail::option<struct forward_error_correction_tag, size_t>;
+
+// Libutp tuning knobs. On a socket they apply to that connection only, on a
+// `udp_multiplexer` they become the defaults for the connections created
+// afterwards by sockets bound to the same local endpoint. Options set on a
+// socket before it's connected (or accepted) are applied as soon as the
+// connection exists; note that an accepted connection has already answered
+// the handshake with the multiplexer's defaults by then.
+//
+// The queuing delay LEDBAT congestion control aims for (100ms by default).
+// Lower values yield to competing traffic sooner, higher ones get more
+// throughput out of paths with deep buffers.
+using target_delay
+    = detail::option<struct target_delay_tag, std::chrono::milliseconds>;
+
+// How much data libutp keeps in flight and in its receive window, in bytes.
+// To fill a path both should be at least its bandwidth-delay product (as
+// should the multiplexer's UDP socket buffers). Note that libutp also caps
+// the packets in flight at 1023 (about 1.4MB), which no option lifts.
+using send_buffer_size = detail::option<struct send_buffer_size_tag, size_t>;
+using receive_buffer_size = detail::option<struct receive_buffer_size_tag, size_t>;
+
+enum class congestion_controller {
+    // LEDBAT as implemented by libutp: backs off as soon as it sees the
+    // queuing delay grow past `target_delay`, so it yields to TCP.
+    ledbat,
+
+    // LEDBAT with a target delay of 5s. It still reacts to delay, but only
+    // to queues far deeper than TCP fills, so in practice it mostly backs
+    // off on packet loss and yields to TCP much less. This is not a loss
+    // based controller, libutp has no way of plugging in a different one.
+    // For traffic that shouldn't yield, e.g. between hosts we control.
+    ledbat_large_target
+};
+
+// Per socket, `ledbat` by default. While `ledbat_large_target` is selected,
+// the socket's `target_delay` is ignored (and reported as the one used
+// instead).
+using congestion_control
+    = detail::option<struct congestion_control_tag, congestion_controller>;
+
+} // namespace
@@ -1,40 +1,274 @@
 #pragma once
 
 #include <boost/asio/ip/udp.hpp>
+#include <boost/asio/async_result.hpp>
+#include <boost/asio/socket_base.hpp>
 #include <boost/asio/buffers_iterator.hpp>
 #include "detail/handler.hpp"
+#include "detail/buffer_sequence.hpp"
+#include "options.hpp"
+#include "chunk.hpp"
 
 namespace asio_utp {
 
 class socket_impl;
-class udp_multiplexer;
 
-class socket {
+namespace detail {
+    class udp_multiplexer_base;
+    struct connect_any_state;
+}
+
+// Identifies the part of a buffer registered with `socket::provide_buffers`
+// that received data was written into.
+struct provided_buffer {
+    size_t index;
+    size_t size;
+};
+
+// What the library remembers about the path to a peer address from earlier
+// connections, see `socket::cached_path_metrics`. Zero means unknown.
+struct path_metrics {
+    // Smoothed round trip time of the handshakes and its variation.
+    std::chrono::microseconds srtt{0};
+    std::chrono::microseconds rttvar{0};
+
+    // Delay above the base delay libutp measured last.
+    std::chrono::microseconds queuing_delay{0};
+
+    // Libutp's MTU estimate (only available with libutp's statistics).
+    size_t mtu = 0;
+
+    std::chrono::steady_clock::time_point updated;
+};
+
+// Counters of all the sockets bound to the same local endpoint, see
+// `socket::get_context_stats`.
+struct context_stats {
+    // uTP data packets received and acknowledgements sent without data,
+    // their ratio shows the effect of `ack_frequency`.
+    uint64_t data_packets_received = 0;
+    uint64_t acks_sent = 0;
+
+    // See `forward_error_correction`.
+    uint64_t fec_parity_packets_sent = 0;
+    uint64_t fec_packets_recovered = 0;
+};
+
+namespace detail {
+
+// The part of `basic_socket` that doesn't depend on the executor type.
+class socket_base {
 public:
     using endpoint_type = boost::asio::ip::udp::endpoint;
-    using executor_type = boost::asio::io_context::executor_type;
+    using wait_type = boost::asio::socket_base::wait_type;
+
+    using on_data_handler = size_t( const boost::system::error_code&
+                                  , boost::asio::const_buffer);
 
 public:
-    socket() = default;
+    socket_base(const socket_base&) = delete;
+    socket_base& operator=(const socket_base&) = delete;
 
-    socket(const socket&) = delete;
-    socket& operator=(const socket&) = delete;
+    void bind(const endpoint_type&, boost::system::error_code&);
 
-    socket(socket&&);
-    socket& operator=(socket&&);
+    void bind(const udp_multiplexer_base&, boost::system::error_code&);
+
+    // Registers application owned buffers to receive into, similar to
+    // io_uring's provided buffers. Buffers are identified by their index in
+    // the order of registration (calling this again appends more). Received
+    // data is copied from libutp straight into the next free buffer, which
+    // is handed out by `async_receive_provided` and must be given back with
+    // `recycle_buffer` before it is written to again (giving back one the
+    // socket already has fails with `invalid_argument`). While no buffer is
+    // free, data is queued internally and counts against the receive window.
+    // The buffers must stay valid for as long as the socket is open.
+    template<typename MutableBufferSequence>
+    void provide_buffers(const MutableBufferSequence&, boost::system::error_code&);
+
+    void recycle_buffer(size_t index, boost::system::error_code&);
+
+    // Non blocking, these fail with `would_block` instead of waiting.
+    template<typename MutableBufferSequence>
+    size_t read_some(const MutableBufferSequence&, boost::system::error_code&);
+
+    template<typename ConstBufferSequence>
+    size_t write_some(const ConstBufferSequence&, boost::system::error_code&);
+
+    // Number of received bytes that can be read without blocking.
+    size_t available(boost::system::error_code&) const;
+
+    // Registers a handler invoked with the received data as soon as it
+    // arrives, as an alternative to `async_read_some`. The handler returns
+    // how many bytes it consumed, the rest stays queued (and counts against
+    // the receive window) until it is read with the read functions above or
+    // offered to the handler again with the next received packet. End of
+    // stream is signaled with `connection_reset` and an empty buffer.
+    //
+    // The handler runs from within the receive path, pass an empty function
+    // to unregister it. Requires the socket to be bound.
+    void on_data(std::function<on_data_handler>);
 
-    socket(const boost::asio::executor&);
-    socket(boost::asio::io_context&);
+    endpoint_type local_endpoint() const;
 
-    void bind(const endpoint_type&, boost::system::error_code&);
+    endpoint_type remote_endpoint() const;
+
+    bool is_open() const;
+
+    // Largest payload `async_send_datagram` accepts, small enough for the
+    // datagram to fit into a single UDP packet on a typical path.
+    static const size_t max_datagram_size = 1200;
+
+    void set_option(const cork&, boost::system::error_code&);
+    void get_option(cork&, boost::system::error_code&) const;
+
+    void set_option(const coalesce_delay&, boost::system::error_code&);
+    void get_option(coalesce_delay&, boost::system::error_code&) const;
+
+    void set_option(const immediate_completion&, boost::system::error_code&);
+    void get_option(immediate_completion&, boost::system::error_code&) const;
+
+    void set_option(const max_message_size&, boost::system::error_code&);
+    void get_option(max_message_size&, boost::system::error_code&) const;
+
+    void set_option(const server_first&, boost::system::error_code&);
+    void get_option(server_first&, boost::system::error_code&) const;
+
+    void set_option(const path_metrics_expiry&, boost::system::error_code&);
+    void get_option(path_metrics_expiry&, boost::system::error_code&) const;
 
-    void bind(const udp_multiplexer&, boost::system::error_code&);
+    void set_option(const target_delay&, boost::system::error_code&);
+    void get_option(target_delay&, boost::system::error_code&) const;
+
+    void set_option(const send_buffer_size&, boost::system::error_code&);
+    void get_option(send_buffer_size&, boost::system::error_code&) const;
+
+    void set_option(const receive_buffer_size&, boost::system::error_code&);
+    void get_option(receive_buffer_size&, boost::system::error_code&) const;
+
+    void set_option(const congestion_control&, boost::system::error_code&);
+    void get_option(congestion_control&, boost::system::error_code&) const;
+
+    void set_option(const forward_error_correction&, boost::system::error_code&);
+    void get_option(forward_error_correction&, boost::system::error_code&) const;
+
+    void set_option(const ack_frequency&, boost::system::error_code&);
+    void get_option(ack_frequency&, boost::system::error_code&) const;
+
+    void set_option(const max_ack_delay&, boost::system::error_code&);
+    void get_option(max_ack_delay&, boost::system::error_code&) const;
+
+    context_stats get_context_stats(boost::system::error_code&) const;
+
+    // Metrics the socket's context remembers about `address`, returns false
+    // if there are none (or they expired). Libutp doesn't let us seed a new
+    // connection with them, but they can be used e.g. to pick a connect
+    // timeout before the first RTT sample of the connection is in.
+    bool cached_path_metrics( const boost::asio::ip::address&
+                            , path_metrics&
+                            , boost::system::error_code&) const;
+
+    // Hand over any data held back by `cork` or `coalesce_delay` to libutp.
+    void flush(boost::system::error_code&);
+
+    void close();
+
+    // For debugging only
+    void* pimpl() const { return _socket_impl.get(); }
+
+protected:
+    socket_base() = default;
+    socket_base(const boost::asio::executor&);
+
+    socket_base(socket_base&&);
+    socket_base& operator=(socket_base&&);
+
+    ~socket_base();
+
+    void do_connect(const endpoint_type&, handler<>&&);
+    void do_connect_with_data(const endpoint_type&, handler<size_t>&&);
+    void do_accept (handler<>&&);
+    void do_write  (handler<size_t>&&);
+    void do_read   (handler<size_t>&&);
+    void do_write_all(handler<size_t>&&);
+    void do_read_exactly(handler<size_t>&&);
+    void do_wait   (wait_type, handler<>&&);
+    void do_receive_chunks(handler<std::vector<chunk>>&&);
+    void do_receive_provided(handler<provided_buffer>&&);
+    void do_send_message(handler<size_t>&&);
+    void do_receive_message(handler<std::vector<unsigned char>>&&);
+    void do_send_datagram(handler<size_t>&&);
+    void do_receive_datagram(handler<size_t>&&);
+    void do_provide_buffers( const std::vector<boost::asio::mutable_buffer>&
+                           , boost::system::error_code&);
+
+    size_t do_read_some(boost::system::error_code&);
+    size_t do_write_some(boost::system::error_code&);
+
+    buffer_sequence<boost::asio::const_buffer>* tx_buffers();
+    buffer_sequence<boost::asio::mutable_buffer>* rx_buffers();
+
+    buffer_sequence<boost::asio::const_buffer>* datagram_tx_buffers();
+    buffer_sequence<boost::asio::mutable_buffer>* datagram_rx_buffers();
+
+    handler_memory* tx_handler_memory();
+    handler_memory* rx_handler_memory();
+
+private:
+    friend class ::asio_utp::socket_impl;
+    friend struct connect_any_state;
+
+    // Type erased copy of the socket's executor. Only used by the
+    // implementation for things outside of the data path (timers, cleanup).
+    boost::asio::executor _impl_ex;
+    std::shared_ptr<socket_impl> _socket_impl;
+};
+
+} // detail namespace
+
+// Completion handlers which don't have an executor associated with them are
+// invoked through `Executor`. Using a concrete executor type (such as
+// `io_context::executor_type` or a strand of it) instead of the default
+// polymorphic one lets posting and dispatching of handlers be inlined.
+template<class Executor = boost::asio::executor>
+class basic_socket : public detail::socket_base {
+public:
+    using executor_type = Executor;
+
+    template<class OtherExecutor>
+    struct rebind_executor {
+        using other = basic_socket<OtherExecutor>;
+    };
+
+public:
+    basic_socket() = default;
+
+    basic_socket(basic_socket&&) = default;
+    basic_socket& operator=(basic_socket&&) = default;
+
+    basic_socket(const executor_type&);
+
+    template<class ExecutionContext, class = std::enable_if_t<
+        std::is_convertible< ExecutionContext&
+                           , boost::asio::execution_context&>::value>>
+    basic_socket(ExecutionContext&);
 
     template<typename CompletionToken>
-    void async_connect(const endpoint_type&, CompletionToken&&);
+    auto async_connect(const endpoint_type&, CompletionToken&&);
+
+    // Connects and sends `bufs` as the first data on the connection, e.g. a
+    // request. The data is handed over to libutp as soon as the handshake
+    // completes, without a round trip through the executor, and it also
+    // lets the accepting side (which can't send before it has received
+    // something) answer right away. Completes once connected and all of the
+    // data was accepted by libutp, with the number of bytes sent.
+    template< typename ConstBufferSequence
+            , typename CompletionToken>
+    auto async_connect( const endpoint_type&
+                      , const ConstBufferSequence&
+                      , CompletionToken&&);
 
     template<typename CompletionToken>
-    void async_accept(CompletionToken&&);
+    auto async_accept(CompletionToken&&);
 
     template< typename ConstBufferSequence
             , typename CompletionToken>
@@ -44,109 +278,390 @@ public:
             , typename CompletionToken>
     auto async_read_some(const MutableBufferSequence&, CompletionToken&&);
 
-    endpoint_type local_endpoint() const;
+    // Like `asio::async_write` and `asio::async_read` with the default
+    // completion condition, but done inside the socket: the operation stays
+    // pending across libutp events and the handler is invoked only once,
+    // when all of the buffers have been written or filled (or on error, in
+    // which case the number of bytes transferred so far is reported).
+    template< typename ConstBufferSequence
+            , typename CompletionToken>
+    auto async_write_all(const ConstBufferSequence&, CompletionToken&&);
 
-    endpoint_type remote_endpoint() const;
+    template< typename MutableBufferSequence
+            , typename CompletionToken>
+    auto async_read_exactly(const MutableBufferSequence&, CompletionToken&&);
+
+    // Message mode: each message is sent prefixed with its length (four
+    // bytes, big endian) and `async_receive_message` reassembles it on the
+    // other end, completing with the whole message in one buffer. The send
+    // completes once the message has been handed over to libutp and reports
+    // the payload size. Small messages written back to back share packets,
+    // more so with `cork` or `coalesce_delay` set. Don't mix with the stream
+    // reads on the same socket.
+    template< typename ConstBufferSequence
+            , typename CompletionToken>
+    auto async_send_message(const ConstBufferSequence&, CompletionToken&&);
 
-    bool is_open() const;
+    template<typename CompletionToken>
+    auto async_receive_message(CompletionToken&&);
+
+    // Unreliable datagrams sent to the peer of this connection, outside of
+    // the stream: no retransmission, no ordering, no head of line blocking.
+    // A datagram is refused with `no_buffer_space` while the stream is
+    // waiting for the congestion window to open up, so the two share the
+    // LEDBAT pacing. Payloads above `max_datagram_size` fail with
+    // `message_size`. On the receiving side a few datagrams are queued while
+    // no receive is pending, older ones are dropped; datagrams larger than
+    // the buffer are truncated. May be used alongside any of the stream
+    // operations.
+    template< typename ConstBufferSequence
+            , typename CompletionToken>
+    auto async_send_datagram(const ConstBufferSequence&, CompletionToken&&);
 
-    void close();
+    template< typename MutableBufferSequence
+            , typename CompletionToken>
+    auto async_receive_datagram(const MutableBufferSequence&, CompletionToken&&);
+
+    // Completes with all the data received so far (waiting for some if there
+    // is none) without copying it into user buffers. The chunks can be kept
+    // for as long as needed, and can be passed directly to `async_write_some`
+    // of another socket.
+    template<typename CompletionToken>
+    auto async_receive_chunks(CompletionToken&&);
+
+    // Completes with the index of a provided buffer (see `provide_buffers`)
+    // and the number of bytes written into it. A buffer is handed out as soon
+    // as it is full, or partially filled if a read is pending. Fails with
+    // `invalid_argument` if no buffers were provided.
+    template<typename CompletionToken>
+    auto async_receive_provided(CompletionToken&&);
+
+    // Completes once the socket has data to read (`wait_read`) or libutp is
+    // ready to accept more data (`wait_write`). Meant to be used together
+    // with the non blocking `read_some` and `write_some`.
+    template<typename CompletionToken>
+    auto async_wait(wait_type, CompletionToken&&);
 
-    boost::asio::executor get_executor()
+    executor_type get_executor() const
     {
         return _ex;
     }
 
-    // For debugging only
-    void* pimpl() const { return _socket_impl.get(); }
-
-    ~socket();
-
 private:
-    void do_connect(const endpoint_type&, handler<>&&);
-    void do_accept (handler<>&&);
-    void do_write  (handler<size_t>&&);
-    void do_read   (handler<size_t>&&);
+    executor_type _ex;
+};
 
-    std::vector<boost::asio::const_buffer>* tx_buffers();
-    std::vector<boost::asio::mutable_buffer>* rx_buffers();
+using socket = basic_socket<>;
 
-private:
-    friend class socket_impl;
-    boost::asio::executor _ex;
-    std::shared_ptr<socket_impl> _socket_impl;
-};
+template<class Executor>
+inline
+basic_socket<Executor>::basic_socket(const executor_type& ex)
+    : socket_base(ex)
+    , _ex(ex)
+{}
+
+template<class Executor>
+template<class ExecutionContext, class>
+inline
+basic_socket<Executor>::basic_socket(ExecutionContext& ctx)
+    : basic_socket(executor_type(ctx.get_executor()))
+{}
 
+template<class Executor>
 template<typename CompletionToken>
 inline
-void socket::async_connect(const endpoint_type& ep, CompletionToken&& token)
+auto basic_socket<Executor>::async_connect(const endpoint_type& ep, CompletionToken&& token)
 {
-    boost::asio::async_completion
-        <CompletionToken, void(boost::system::error_code)> c(token);
+    return boost::asio::async_initiate
+        < CompletionToken
+        , void(boost::system::error_code)
+        >([this, ep] (auto h) {
+            do_connect(ep, {get_executor(), std::move(h)});
+          }, token);
+}
 
-    do_connect(ep, {get_executor(), std::move(c.completion_handler)});
+template<class Executor>
+template< typename ConstBufferSequence
+        , typename CompletionToken>
+inline
+auto basic_socket<Executor>::async_connect( const endpoint_type& ep
+                                          , const ConstBufferSequence& bufs
+                                          , CompletionToken&& token)
+{
+    if (auto txb = tx_buffers()) {
+        txb->assign(bufs);
+    }
 
-    return c.result.get();
+    return boost::asio::async_initiate
+        < CompletionToken
+        , void(boost::system::error_code, size_t)
+        >([this, ep] (auto h) {
+            do_connect_with_data(ep, { get_executor()
+                                     , std::move(h)
+                                     , tx_handler_memory()});
+          }, token);
 }
 
+template<class Executor>
 template<typename CompletionToken>
 inline
-void socket::async_accept(CompletionToken&& token)
+auto basic_socket<Executor>::async_accept(CompletionToken&& token)
 {
-    boost::asio::async_completion
-        <CompletionToken, void(boost::system::error_code)> c(token);
-
-    do_accept({get_executor(), std::move(c.completion_handler)});
-
-    return c.result.get();
+    return boost::asio::async_initiate
+        < CompletionToken
+        , void(boost::system::error_code)
+        >([this] (auto h) {
+            do_accept({get_executor(), std::move(h)});
+          }, token);
 }
 
+template<class Executor>
 template< typename ConstBufferSequence
         , typename CompletionToken>
 inline
-auto socket::async_write_some( const ConstBufferSequence& bufs
-                             , CompletionToken&& token)
+auto basic_socket<Executor>::async_write_some( const ConstBufferSequence& bufs
+                                             , CompletionToken&& token)
 {
     if (auto txb = tx_buffers()) {
-        txb->clear();
+        txb->assign(bufs);
+    }
+
+    return boost::asio::async_initiate
+        < CompletionToken
+        , void(boost::system::error_code, size_t)
+        >([this] (auto h) {
+            do_write({ get_executor()
+                     , std::move(h)
+                     , tx_handler_memory()});
+          }, token);
+}
 
-        std::copy( boost::asio::buffer_sequence_begin(bufs)
-                 , boost::asio::buffer_sequence_end(bufs)
-                 , std::back_inserter(*txb));
+template<class Executor>
+template< typename MutableBufferSequence
+        , typename CompletionToken>
+inline
+auto basic_socket<Executor>::async_read_some( const MutableBufferSequence& bufs
+                                            , CompletionToken&& token)
+{
+    if (auto rxb = rx_buffers()) {
+        rxb->assign(bufs);
     }
 
-    boost::asio::async_completion
+    return boost::asio::async_initiate
         < CompletionToken
         , void(boost::system::error_code, size_t)
-        > c(token);
+        >([this] (auto h) {
+            do_read({ get_executor()
+                    , std::move(h)
+                    , rx_handler_memory()});
+          }, token);
+}
 
-    do_write({get_executor(), std::move(c.completion_handler)});
+template<class Executor>
+template< typename ConstBufferSequence
+        , typename CompletionToken>
+inline
+auto basic_socket<Executor>::async_write_all( const ConstBufferSequence& bufs
+                                            , CompletionToken&& token)
+{
+    if (auto txb = tx_buffers()) {
+        txb->assign(bufs);
+    }
 
-    return c.result.get();
+    return boost::asio::async_initiate
+        < CompletionToken
+        , void(boost::system::error_code, size_t)
+        >([this] (auto h) {
+            do_write_all({ get_executor()
+                         , std::move(h)
+                         , tx_handler_memory()});
+          }, token);
 }
 
+template<class Executor>
 template< typename MutableBufferSequence
         , typename CompletionToken>
 inline
-auto socket::async_read_some( const MutableBufferSequence& bufs
-                            , CompletionToken&& token)
+auto basic_socket<Executor>::async_read_exactly( const MutableBufferSequence& bufs
+                                               , CompletionToken&& token)
 {
     if (auto rxb = rx_buffers()) {
-        rxb->clear();
+        rxb->assign(bufs);
+    }
+
+    return boost::asio::async_initiate
+        < CompletionToken
+        , void(boost::system::error_code, size_t)
+        >([this] (auto h) {
+            do_read_exactly({ get_executor()
+                            , std::move(h)
+                            , rx_handler_memory()});
+          }, token);
+}
+
+template<class Executor>
+template< typename ConstBufferSequence
+        , typename CompletionToken>
+inline
+auto basic_socket<Executor>::async_send_message( const ConstBufferSequence& bufs
+                                               , CompletionToken&& token)
+{
+    if (auto txb = tx_buffers()) {
+        // The first buffer is where the length prefix goes.
+        txb->assign(boost::asio::const_buffer(), bufs);
+    }
+
+    return boost::asio::async_initiate
+        < CompletionToken
+        , void(boost::system::error_code, size_t)
+        >([this] (auto h) {
+            do_send_message({ get_executor()
+                            , std::move(h)
+                            , tx_handler_memory()});
+          }, token);
+}
+
+template<class Executor>
+template<typename CompletionToken>
+inline
+auto basic_socket<Executor>::async_receive_message(CompletionToken&& token)
+{
+    return boost::asio::async_initiate
+        < CompletionToken
+        , void(boost::system::error_code, std::vector<unsigned char>)
+        >([this] (auto h) {
+            do_receive_message({ get_executor()
+                               , std::move(h)
+                               , rx_handler_memory()});
+          }, token);
+}
 
-        std::copy( boost::asio::buffer_sequence_begin(bufs)
-                 , boost::asio::buffer_sequence_end(bufs)
-                 , std::back_inserter(*rxb));
+template<class Executor>
+template< typename ConstBufferSequence
+        , typename CompletionToken>
+inline
+auto basic_socket<Executor>::async_send_datagram( const ConstBufferSequence& bufs
+                                                , CompletionToken&& token)
+{
+    if (auto txb = datagram_tx_buffers()) {
+        // The first buffer is where the datagram header goes.
+        txb->assign(boost::asio::const_buffer(), bufs);
+    }
+
+    return boost::asio::async_initiate
+        < CompletionToken
+        , void(boost::system::error_code, size_t)
+        >([this] (auto h) {
+            do_send_datagram({get_executor(), std::move(h)});
+          }, token);
+}
+
+template<class Executor>
+template< typename MutableBufferSequence
+        , typename CompletionToken>
+inline
+auto basic_socket<Executor>::async_receive_datagram( const MutableBufferSequence& bufs
+                                                   , CompletionToken&& token)
+{
+    if (auto rxb = datagram_rx_buffers()) {
+        rxb->assign(bufs);
     }
 
-    boost::asio::async_completion
+    return boost::asio::async_initiate
         < CompletionToken
         , void(boost::system::error_code, size_t)
-        > c(token);
+        >([this] (auto h) {
+            do_receive_datagram({get_executor(), std::move(h)});
+          }, token);
+}
+
+template<class Executor>
+template<typename CompletionToken>
+inline
+auto basic_socket<Executor>::async_receive_chunks(CompletionToken&& token)
+{
+    return boost::asio::async_initiate
+        < CompletionToken
+        , void(boost::system::error_code, std::vector<chunk>)
+        >([this] (auto h) {
+            do_receive_chunks({ get_executor()
+                              , std::move(h)
+                              , rx_handler_memory()});
+          }, token);
+}
+
+template<typename MutableBufferSequence>
+inline
+void detail::socket_base::provide_buffers( const MutableBufferSequence& bufs
+                                         , boost::system::error_code& ec)
+{
+    std::vector<boost::asio::mutable_buffer> v
+        ( boost::asio::buffer_sequence_begin(bufs)
+        , boost::asio::buffer_sequence_end(bufs));
+
+    do_provide_buffers(v, ec);
+}
+
+template<class Executor>
+template<typename CompletionToken>
+inline
+auto basic_socket<Executor>::async_receive_provided(CompletionToken&& token)
+{
+    return boost::asio::async_initiate
+        < CompletionToken
+        , void(boost::system::error_code, provided_buffer)
+        >([this] (auto h) {
+            do_receive_provided({ get_executor()
+                                , std::move(h)
+                                , rx_handler_memory()});
+          }, token);
+}
+
+template<class Executor>
+template<typename CompletionToken>
+inline
+auto basic_socket<Executor>::async_wait(wait_type w, CompletionToken&& token)
+{
+    return boost::asio::async_initiate
+        < CompletionToken
+        , void(boost::system::error_code)
+        >([this, w] (auto h) {
+            do_wait(w, {get_executor(), std::move(h)});
+          }, token);
+}
+
+template<typename MutableBufferSequence>
+inline
+size_t detail::socket_base::read_some( const MutableBufferSequence& bufs
+                                     , boost::system::error_code& ec)
+{
+    auto rxb = rx_buffers();
+
+    if (!rxb) {
+        ec = boost::asio::error::bad_descriptor;
+        return 0;
+    }
+
+    rxb->assign(bufs);
+
+    return do_read_some(ec);
+}
+
+template<typename ConstBufferSequence>
+inline
+size_t detail::socket_base::write_some( const ConstBufferSequence& bufs
+                                      , boost::system::error_code& ec)
+{
+    auto txb = tx_buffers();
+
+    if (!txb) {
+        ec = boost::asio::error::bad_descriptor;
+        return 0;
+    }
 
-    do_read({get_executor(), std::move(c.completion_handler)});
+    txb->assign(bufs);
 
-    return c.result.get();
+    return do_write_some(ec);
 }
 
 } // namespace
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <asio_utp/socket.hpp>
+
+namespace asio_utp {
+
+class stream_multiplexer;
+
+namespace detail {
+    struct stream_state;
+    struct stream_multiplexer_state;
+}
+
+// A logical, bidirectional stream carried over a `stream_multiplexer`.
+// Implements the AsyncReadStream and AsyncWriteStream requirements. End of
+// stream is signaled with `connection_reset` (same as on `socket`).
+class stream {
+public:
+    using executor_type = boost::asio::executor;
+
+public:
+    stream() = default;
+
+    stream(const stream&) = delete;
+    stream& operator=(const stream&) = delete;
+
+    stream(stream&&) = default;
+    stream& operator=(stream&&);
+
+    template< typename MutableBufferSequence
+            , typename CompletionToken>
+    auto async_read_some(const MutableBufferSequence&, CompletionToken&&);
+
+    // Completes after at most one frame worth of data has been handed over
+    // to the underlying socket, so that streams writing concurrently take
+    // turns.
+    template< typename ConstBufferSequence
+            , typename CompletionToken>
+    auto async_write_some(const ConstBufferSequence&, CompletionToken&&);
+
+    uint32_t id() const;
+
+    bool is_open() const;
+
+    // Aborts pending operations and lets the other end know no more data is
+    // coming.
+    void close();
+
+    executor_type get_executor() const
+    {
+        return _ex;
+    }
+
+    ~stream();
+
+private:
+    friend class stream_multiplexer;
+    friend struct detail::stream_multiplexer_state;
+
+    stream(const executor_type&, std::shared_ptr<detail::stream_state>);
+
+    void do_read (handler<size_t>&&);
+    void do_write(handler<size_t>&&);
+
+    detail::buffer_sequence<boost::asio::const_buffer>* tx_buffers();
+    detail::buffer_sequence<boost::asio::mutable_buffer>* rx_buffers();
+
+private:
+    executor_type _ex;
+    std::shared_ptr<detail::stream_state> _state;
+};
+
+// Carries many `stream`s over one connected uTP socket, so that they share
+// the handshake and the congestion control state. Opening a stream costs no
+// round trip, each stream has its own flow control window, and streams with
+// data to send take turns one frame at a time.
+//
+// Frames are a 9 byte header (type, stream id, length; big endian) followed
+// by the payload of data frames. Both ends of the connection need to use a
+// `stream_multiplexer`, one with `role::client` and the other with
+// `role::server` (this only decides which stream ids each end allocates).
+class stream_multiplexer {
+public:
+    using executor_type = boost::asio::executor;
+
+    enum class role { client, server };
+
+    // Flow control window of each stream, in each direction.
+    static const size_t stream_window = 256 * 1024;
+
+    // Largest payload of a single data frame.
+    static const size_t max_frame_payload = 16 * 1024;
+
+public:
+    stream_multiplexer(socket&&, role);
+
+    stream_multiplexer(const stream_multiplexer&) = delete;
+    stream_multiplexer& operator=(const stream_multiplexer&) = delete;
+
+    stream_multiplexer(stream_multiplexer&&) = default;
+    stream_multiplexer& operator=(stream_multiplexer&&);
+
+    // Creates a new stream. The other end is notified with the first frame
+    // written after this call, no round trip is involved.
+    stream open_stream(boost::system::error_code&);
+
+    // Completes with a stream opened by the other end.
+    template<typename CompletionToken>
+    auto async_accept_stream(CompletionToken&&);
+
+    bool is_open() const;
+
+    // Closes the underlying socket, operations on all streams are aborted.
+    void close();
+
+    executor_type get_executor() const
+    {
+        return _ex;
+    }
+
+    ~stream_multiplexer();
+
+private:
+    void do_accept(handler<stream>&&);
+
+private:
+    executor_type _ex;
+    std::shared_ptr<detail::stream_multiplexer_state> _state;
+};
+
+template< typename MutableBufferSequence
+        , typename CompletionToken>
+inline
+auto stream::async_read_some( const MutableBufferSequence& bufs
+                            , CompletionToken&& token)
+{
+    if (auto rxb = rx_buffers()) {
+        rxb->assign(bufs);
+    }
+
+    return boost::asio::async_initiate
+        < CompletionToken
+        , void(boost::system::error_code, size_t)
+        >([this] (auto h) {
+            do_read({get_executor(), std::move(h)});
+          }, token);
+}
+
+template< typename ConstBufferSequence
+        , typename CompletionToken>
+inline
+auto stream::async_write_some( const ConstBufferSequence& bufs
+                             , CompletionToken&& token)
+{
+    if (auto txb = tx_buffers()) {
+        txb->assign(bufs);
+    }
+
+    return boost::asio::async_initiate
+        < CompletionToken
+        , void(boost::system::error_code, size_t)
+        >([this] (auto h) {
+            do_write({get_executor(), std::move(h)});
+          }, token);
+}
+
+template<typename CompletionToken>
+inline
+auto stream_multiplexer::async_accept_stream(CompletionToken&& token)
+{
+    return boost::asio::async_initiate
+        < CompletionToken
+        , void(boost::system::error_code, stream)
+        >([this] (auto h) {
+            do_accept({get_executor(), std::move(h)});
+          }, token);
+}
+
+} // namespace
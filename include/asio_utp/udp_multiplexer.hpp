@@ -1,15 +1,22 @@
 #pragma once
 
 #include <boost/asio/ip/udp.hpp>
+#include <boost/asio/async_result.hpp>
 #include <asio_utp/detail/handler.hpp>
 #include <asio_utp/detail/signal.hpp>
+#include <asio_utp/detail/buffer_sequence.hpp>
+#include <asio_utp/options.hpp>
 
 namespace asio_utp {
 
 class udp_multiplexer_impl;
 class socket_impl;
 
-class udp_multiplexer {
+namespace detail {
+
+// The part of `basic_udp_multiplexer` that doesn't depend on the executor
+// type.
+class udp_multiplexer_base {
 private:
     struct state;
 
@@ -25,19 +32,108 @@ public:
     using on_send_to_connection = Signal<on_send_to_handler>::Connection;
 
 public:
-    udp_multiplexer() = default;
+    udp_multiplexer_base(const udp_multiplexer_base&) = delete;
+    udp_multiplexer_base& operator=(const udp_multiplexer_base&) = delete;
+
+    void bind(const endpoint_type& local_endpoint, boost::system::error_code&);
+    void bind(const udp_multiplexer_base&, boost::system::error_code&);
+
+    on_send_to_connection on_send_to(std::function<on_send_to_handler> handler);
 
-    udp_multiplexer(const udp_multiplexer&) = delete;
-    udp_multiplexer& operator=(const udp_multiplexer&) = delete;
+    endpoint_type local_endpoint() const;
 
-    udp_multiplexer(udp_multiplexer&&) = default;
-    udp_multiplexer& operator=(udp_multiplexer&&) = default;
+    bool is_open() const;
 
-    udp_multiplexer(boost::asio::io_context&);
-    udp_multiplexer(const boost::asio::executor&);
+    // Defaults for the libutp connections made through this multiplexer (see
+    // `target_delay`). They stay in effect for as long as the multiplexer or
+    // any socket bound to it is alive.
+    void set_option(const target_delay&, boost::system::error_code&);
+    void get_option(target_delay&, boost::system::error_code&) const;
 
-    void bind(const endpoint_type& local_endpoint, boost::system::error_code&);
-    void bind(const udp_multiplexer&, boost::system::error_code&);
+    void set_option(const send_buffer_size&, boost::system::error_code&);
+    void get_option(send_buffer_size&, boost::system::error_code&) const;
+
+    void set_option(const receive_buffer_size&, boost::system::error_code&);
+    void get_option(receive_buffer_size&, boost::system::error_code&) const;
+
+    void set_option(const ack_frequency&, boost::system::error_code&);
+    void get_option(ack_frequency&, boost::system::error_code&) const;
+
+    void set_option(const max_ack_delay&, boost::system::error_code&);
+    void get_option(max_ack_delay&, boost::system::error_code&) const;
+
+    // The UDP socket's SO_RCVBUF and SO_SNDBUF. The OS defaults are usually
+    // far below the bandwidth-delay product of fast long distance paths, and
+    // packets the OS drops for lack of space are losses to libutp.
+    void set_option( const boost::asio::socket_base::receive_buffer_size&
+                   , boost::system::error_code&);
+    void get_option( boost::asio::socket_base::receive_buffer_size&
+                   , boost::system::error_code&) const;
+
+    void set_option( const boost::asio::socket_base::send_buffer_size&
+                   , boost::system::error_code&);
+    void get_option( boost::asio::socket_base::send_buffer_size&
+                   , boost::system::error_code&) const;
+
+    void close(boost::system::error_code&);
+
+protected:
+    udp_multiplexer_base() = default;
+    udp_multiplexer_base(const boost::asio::executor&);
+
+    udp_multiplexer_base(udp_multiplexer_base&&) = default;
+    udp_multiplexer_base& operator=(udp_multiplexer_base&&) = default;
+
+    ~udp_multiplexer_base();
+
+    void do_receive(endpoint_type& ep, handler<size_t>&&);
+    void do_send(const endpoint_type& ep, handler<size_t>&&);
+
+    buffer_sequence<boost::asio::mutable_buffer>* rx_buffers();
+    buffer_sequence<boost::asio::const_buffer>*   tx_buffers();
+
+    handler_memory* rx_handler_memory();
+    handler_memory* tx_handler_memory();
+
+private:
+    friend class ::asio_utp::socket_impl;
+    std::shared_ptr<udp_multiplexer_impl> impl() const;
+
+    void set_utp_option(int opt, int value, boost::system::error_code&);
+    int get_utp_option(int opt, boost::system::error_code&) const;
+
+private:
+    // Type erased copy of the multiplexer's executor, see
+    // `detail::socket_base`.
+    boost::asio::executor _impl_ex;
+    std::shared_ptr<state> _state;
+};
+
+} // detail namespace
+
+// See `basic_socket` for the role of `Executor`.
+template<class Executor = boost::asio::executor>
+class basic_udp_multiplexer : public detail::udp_multiplexer_base {
+public:
+    using executor_type = Executor;
+
+    template<class OtherExecutor>
+    struct rebind_executor {
+        using other = basic_udp_multiplexer<OtherExecutor>;
+    };
+
+public:
+    basic_udp_multiplexer() = default;
+
+    basic_udp_multiplexer(basic_udp_multiplexer&&) = default;
+    basic_udp_multiplexer& operator=(basic_udp_multiplexer&&) = default;
+
+    basic_udp_multiplexer(const executor_type&);
+
+    template<class ExecutionContext, class = std::enable_if_t<
+        std::is_convertible< ExecutionContext&
+                           , boost::asio::execution_context&>::value>>
+    basic_udp_multiplexer(ExecutionContext&);
 
     template< typename MutableBufferSequence
             , typename CompletionToken>
@@ -51,84 +147,75 @@ public:
                       , const endpoint_type& destination
                       , CompletionToken&&);
 
-    on_send_to_connection on_send_to(std::function<on_send_to_handler> handler);
-
-    boost::asio::executor get_executor()
+    executor_type get_executor() const
     {
         return _ex;
     }
 
-    endpoint_type local_endpoint() const;
-
-    bool is_open() const;
-
-    void close(boost::system::error_code&);
-
-    ~udp_multiplexer();
-
 private:
-    void do_receive(endpoint_type& ep, handler<size_t>&&);
-    void do_send(const endpoint_type& ep, handler<size_t>&&);
+    executor_type _ex;
+};
 
-    std::vector<boost::asio::mutable_buffer>* rx_buffers();
-    std::vector<boost::asio::const_buffer>*   tx_buffers();
+using udp_multiplexer = basic_udp_multiplexer<>;
 
-    friend class socket_impl;
-    std::shared_ptr<udp_multiplexer_impl> impl() const;
+template<class Executor>
+inline
+basic_udp_multiplexer<Executor>::basic_udp_multiplexer(const executor_type& ex)
+    : udp_multiplexer_base(ex)
+    , _ex(ex)
+{}
 
-private:
-    boost::asio::executor _ex;
-    std::shared_ptr<state> _state;
-};
+template<class Executor>
+template<class ExecutionContext, class>
+inline
+basic_udp_multiplexer<Executor>::basic_udp_multiplexer(ExecutionContext& ctx)
+    : basic_udp_multiplexer(executor_type(ctx.get_executor()))
+{}
 
+template<class Executor>
 template< typename MutableBufferSequence
         , typename CompletionToken>
 inline
-auto udp_multiplexer::async_receive_from( const MutableBufferSequence& bufs
-                                        , endpoint_type& ep
-                                        , CompletionToken&& token)
+auto basic_udp_multiplexer<Executor>::async_receive_from
+    ( const MutableBufferSequence& bufs
+    , endpoint_type& ep
+    , CompletionToken&& token)
 {
     if (auto rx_bufs = rx_buffers()) {
-        rx_bufs->clear();
-
-        std::copy( boost::asio::buffer_sequence_begin(bufs)
-                 , boost::asio::buffer_sequence_end(bufs)
-                 , std::back_inserter(*rx_bufs));
+        rx_bufs->assign(bufs);
     }
 
-    boost::asio::async_completion
+    return boost::asio::async_initiate
         < CompletionToken
         , void(boost::system::error_code, size_t)
-        > c(token);
-
-    do_receive(ep, {get_executor(), std::move(c.completion_handler)});
-
-    return c.result.get();
+        >([this, &ep] (auto h) {
+            do_receive(ep, { get_executor()
+                           , std::move(h)
+                           , rx_handler_memory()});
+          }, token);
 }
 
+template<class Executor>
 template< typename ConstBufferSequence
         , typename CompletionToken>
 inline
-auto udp_multiplexer::async_send_to( const ConstBufferSequence& bufs
-                                   , const endpoint_type& destination
-                                   , CompletionToken&& token)
+auto basic_udp_multiplexer<Executor>::async_send_to
+    ( const ConstBufferSequence& bufs
+    , const endpoint_type& destination
+    , CompletionToken&& token)
 {
     if (auto tx_bufs = tx_buffers()) {
-        tx_bufs->clear();
-
-        std::copy( boost::asio::buffer_sequence_begin(bufs)
-                 , boost::asio::buffer_sequence_end(bufs)
-                 , std::back_inserter(*tx_bufs));
+        tx_bufs->assign(bufs);
     }
 
-    boost::asio::async_completion
+    return boost::asio::async_initiate
         < CompletionToken
         , void(boost::system::error_code, size_t)
-        > c(token);
-
-    do_send(destination, {get_executor(), std::move(c.completion_handler)});
-
-    return c.result.get();
+        >([this, destination] (auto h) {
+            do_send(destination, { get_executor()
+                                 , std::move(h)
+                                 , tx_handler_memory()});
+          }, token);
 }
 
 } // asio_utp
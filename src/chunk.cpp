@@ -0,0 +1,133 @@
+#include <asio_utp/chunk.hpp>
+#include "chunk_pool.hpp"
+
+#include <cstring>
+#include <new>
+
+using namespace std;
+using namespace asio_utp;
+using detail::chunk_pool;
+
+const size_t chunk_pool::block_capacity;
+const size_t chunk_pool::max_free_blocks;
+
+chunk::chunk(block* b, size_t size)
+    : _block(b)
+    , _begin(0)
+    , _end(size)
+{}
+
+chunk::chunk(const chunk& other)
+    : _block(other._block)
+    , _begin(other._begin)
+    , _end(other._end)
+{
+    if (_block) ++_block->refcount;
+}
+
+chunk& chunk::operator=(const chunk& other)
+{
+    if (this == &other) return *this;
+    if (other._block) ++other._block->refcount;
+    release();
+    _block = other._block;
+    _begin = other._begin;
+    _end   = other._end;
+    return *this;
+}
+
+chunk::chunk(chunk&& other)
+    : _block(other._block)
+    , _begin(other._begin)
+    , _end(other._end)
+{
+    other._block = nullptr;
+    other._begin = other._end = 0;
+}
+
+chunk& chunk::operator=(chunk&& other)
+{
+    if (this == &other) return *this;
+    release();
+    _block = other._block;
+    _begin = other._begin;
+    _end   = other._end;
+    other._block = nullptr;
+    other._begin = other._end = 0;
+    return *this;
+}
+
+void chunk::release()
+{
+    if (!_block) return;
+    if (--_block->refcount == 0) _block->pool->release(_block);
+    _block = nullptr;
+}
+
+chunk::~chunk()
+{
+    release();
+}
+
+chunk::block* chunk_pool::allocate(size_t capacity)
+{
+    void* p = ::operator new(sizeof(chunk::block) + capacity);
+    auto b = new (p) chunk::block;
+    b->capacity = capacity;
+    b->pool = this;
+    return b;
+}
+
+chunk chunk_pool::make_chunk(const unsigned char* data, size_t size)
+{
+    chunk::block* b = nullptr;
+
+    if (size <= block_capacity && _free) {
+        b = _free;
+        _free = b->next;
+        --_free_count;
+    } else {
+        b = allocate(std::max(size, block_capacity));
+    }
+
+    b->refcount = 1;
+    b->next = nullptr;
+    ++_outstanding;
+
+    memcpy(b + 1, data, size);
+
+    return chunk(b, size);
+}
+
+void chunk_pool::release(chunk::block* b)
+{
+    assert(_outstanding);
+    --_outstanding;
+
+    if (_orphaned || b->capacity != block_capacity
+                  || _free_count == max_free_blocks) {
+        ::operator delete(b);
+    } else {
+        b->next = _free;
+        _free = b;
+        ++_free_count;
+    }
+
+    if (_orphaned && _outstanding == 0) delete this;
+}
+
+void chunk_pool::orphan()
+{
+    assert(!_orphaned);
+    _orphaned = true;
+    if (_outstanding == 0) delete this;
+}
+
+chunk_pool::~chunk_pool()
+{
+    while (_free) {
+        auto b = _free;
+        _free = b->next;
+        ::operator delete(b);
+    }
+}
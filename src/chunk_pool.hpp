@@ -0,0 +1,43 @@
+#pragma once
+
+#include <asio_utp/chunk.hpp>
+
+namespace asio_utp { namespace detail {
+
+// Recycles the memory of `chunk`s. The pool belongs to a context, but chunks
+// handed out to the user may outlive it, so instead of being destroyed the
+// pool is `orphan`ed and frees itself once the last block comes back.
+class chunk_pool {
+public:
+    // Large enough for any uTP payload on a typical MTU. Bigger chunks are
+    // allocated exactly and not recycled.
+    static const size_t block_capacity = 2048;
+
+    // Upper bound on the number of unused blocks kept around.
+    static const size_t max_free_blocks = 256;
+
+public:
+    chunk_pool() = default;
+
+    chunk_pool(const chunk_pool&) = delete;
+    chunk_pool& operator=(const chunk_pool&) = delete;
+
+    chunk make_chunk(const unsigned char* data, size_t size);
+
+    void release(chunk::block*);
+
+    void orphan();
+
+private:
+    ~chunk_pool();
+
+    chunk::block* allocate(size_t capacity);
+
+private:
+    chunk::block* _free = nullptr;
+    size_t _free_count = 0;
+    size_t _outstanding = 0;
+    bool _orphaned = false;
+};
+
+}} // namespaces
@@ -0,0 +1,145 @@
+#include <asio_utp/connect.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include "namespaces.hpp"
+#include "socket_impl.hpp"
+
+using namespace std;
+
+namespace asio_utp {
+
+using endpoint_type = socket::endpoint_type;
+
+struct detail::connect_any_state
+    : public enable_shared_from_this<connect_any_state>
+{
+    // The impl of the caller's socket rather than the socket itself, which
+    // may be moved or destroyed while this runs. Whichever socket owns the
+    // impl when an attempt wins takes over its connection.
+    shared_ptr<socket_impl> target;
+    asio::executor ex;
+    vector<endpoint_type> endpoints;
+    chrono::milliseconds stagger;
+    handler<endpoint_type> h;
+
+    // One per endpoint, null when not started yet or already failed.
+    vector<unique_ptr<socket>> attempts;
+    size_t started = 0;
+    size_t failed = 0;
+    sys::error_code last_error;
+    asio::steady_timer timer;
+    bool done = false;
+
+    connect_any_state( socket& s
+                     , vector<endpoint_type> eps
+                     , chrono::milliseconds stagger
+                     , handler<endpoint_type> h)
+        : target(s._socket_impl)
+        , ex(s.get_executor())
+        , endpoints(move(eps))
+        , stagger(stagger)
+        , h(move(h))
+        , attempts(endpoints.size())
+        , timer(ex)
+    {}
+
+    void start_next()
+    {
+        if (started < endpoints.size()) start_attempt(started++);
+        if (!done) arm_timer();
+    }
+
+    void start_attempt(size_t i)
+    {
+        auto s = make_unique<socket>(ex);
+
+        sys::error_code ec;
+        s->bind(target->local_endpoint(), ec);
+
+        if (ec) return on_connect(i, ec);
+
+        attempts[i] = move(s);
+
+        attempts[i]->async_connect(endpoints[i],
+            [self = shared_from_this(), i] (const sys::error_code& ec) {
+                self->on_connect(i, ec);
+            });
+    }
+
+    // Starts the next attempt after `stagger`, and keeps ticking after the
+    // last one has started to notice the target being closed.
+    void arm_timer()
+    {
+        timer.expires_after(stagger);
+        timer.async_wait([self = shared_from_this()] (const sys::error_code& ec) {
+            if (ec || self->done) return;
+
+            if (!self->target->is_open()) {
+                return self->finish(asio::error::operation_aborted, endpoint_type());
+            }
+
+            self->start_next();
+        });
+    }
+
+    void on_connect(size_t i, const sys::error_code& ec)
+    {
+        if (done) return;
+
+        if (ec) {
+            attempts[i] = nullptr;
+            last_error = ec;
+
+            if (++failed == endpoints.size()) {
+                return finish(last_error, endpoint_type());
+            }
+
+            // Don't wait for the timer when we already know this one is out.
+            if (failed == started) start_next();
+            return;
+        }
+
+        auto owner = target->_owner;
+
+        if (!target->is_open() || !owner) {
+            return finish(asio::error::operation_aborted, endpoint_type());
+        }
+
+        // The target's impl only served to tell the attempts where to bind,
+        // the winner (bound to the same endpoint) replaces it.
+        *owner = move(*attempts[i]);
+        finish(ec, endpoints[i]);
+    }
+
+    void finish(const sys::error_code& ec, const endpoint_type& ep)
+    {
+        done = true;
+        timer.cancel();
+
+        // Closes the losers.
+        attempts.clear();
+
+        h.post(ec, ep);
+    }
+};
+
+void detail::do_connect_any( socket& s
+                           , vector<endpoint_type> endpoints
+                           , chrono::milliseconds stagger
+                           , handler<endpoint_type>&& h)
+{
+    if (!s.is_open()) {
+        return h.post(asio::error::bad_descriptor, endpoint_type());
+    }
+
+    if (endpoints.empty()) {
+        return h.post(asio::error::invalid_argument, endpoint_type());
+    }
+
+    auto state = make_shared<connect_any_state>( s
+                                               , move(endpoints)
+                                               , stagger
+                                               , move(h));
+    state->start_next();
+}
+
+} // namespace
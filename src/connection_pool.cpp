@@ -0,0 +1,185 @@
+#include <asio_utp/connection_pool.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include "namespaces.hpp"
+
+using namespace std;
+using namespace asio_utp;
+
+// A socket `async_get` is connecting. Forgotten by the pool (`pool` is then
+// null) once the connect completes or the pool closes.
+struct connection_pool::connecting {
+    connection_pool* pool;
+    list<shared_ptr<connecting>>::iterator pos;
+    socket s;
+    asio::steady_timer timer;
+    bool timed_out = false;
+
+    connecting(connection_pool* pool, const executor_type& ex)
+        : pool(pool)
+        , s(ex)
+        , timer(ex)
+    {}
+};
+
+connection_pool::connection_pool(const executor_type& ex)
+    : connection_pool(ex, limits())
+{}
+
+connection_pool::connection_pool(const executor_type& ex, const limits& l)
+    : _ex(ex)
+    , _limits(l)
+    , _multiplexer(ex)
+{}
+
+void connection_pool::bind(const endpoint_type& ep, sys::error_code& ec)
+{
+    _multiplexer.bind(ep, ec);
+}
+
+connection_pool::endpoint_type connection_pool::local_endpoint() const
+{
+    return _multiplexer.local_endpoint();
+}
+
+size_t connection_pool::idle_count(const endpoint_type& ep) const
+{
+    auto i = _by_peer.find(ep);
+    if (i == _by_peer.end()) return 0;
+    return i->second.size();
+}
+
+// Doesn't block: a socket with nothing to read reports `would_block`, any
+// other outcome means it's closed, at EOF, or out of sync with the peer.
+bool connection_pool::is_reusable(socket& s)
+{
+    if (!s.is_open()) return false;
+
+    unsigned char b;
+    sys::error_code ec;
+    s.read_some(asio::buffer(&b, 1), ec);
+
+    return ec == asio::error::would_block;
+}
+
+void connection_pool::erase(idle_list::iterator i)
+{
+    auto p = _by_peer.find(i->remote);
+    assert(p != _by_peer.end());
+
+    p->second.remove(i);
+    if (p->second.empty()) _by_peer.erase(p);
+
+    _idle.erase(i);
+}
+
+// Takes the most recently released usable socket for `ep`, dropping the
+// ones found to be unusable on the way.
+bool connection_pool::take_idle(const endpoint_type& ep, socket& out)
+{
+    auto now = clock::now();
+
+    while (true) {
+        auto p = _by_peer.find(ep);
+        if (p == _by_peer.end()) return false;
+
+        auto i = p->second.back();
+
+        bool usable = now - i->since <= _limits.max_idle_time
+                   && is_reusable(i->s);
+
+        if (usable) out = move(i->s);
+
+        erase(i);
+
+        if (usable) return true;
+    }
+}
+
+void connection_pool::do_get(const endpoint_type& ep, handler<socket>&& h)
+{
+    socket s;
+
+    if (take_idle(ep, s)) {
+        return h.post(sys::error_code(), move(s));
+    }
+
+    auto c = make_shared<connecting>(this, _ex);
+
+    sys::error_code ec;
+    c->s.bind(_multiplexer, ec);
+
+    if (ec) return h.post(ec, socket());
+
+    _connecting.push_front(c);
+    c->pos = _connecting.begin();
+
+    if (_limits.connect_timeout != clock::duration::zero()) {
+        c->timer.expires_after(_limits.connect_timeout);
+        c->timer.async_wait([wc = weak_ptr<connecting>(c)]
+                            (const sys::error_code& ec) {
+            auto c = wc.lock();
+            if (ec || !c) return;
+            c->timed_out = true;
+            c->s.close();
+        });
+    }
+
+    c->s.async_connect(ep, [c, h = move(h)]
+                           (sys::error_code ec) mutable {
+        c->timer.cancel();
+
+        if (c->pool) {
+            c->pool->_connecting.erase(c->pos);
+            c->pool = nullptr;
+        }
+
+        if (c->timed_out) ec = asio::error::timed_out;
+
+        if (ec) return h.dispatch(ec, socket());
+        h.dispatch(ec, move(c->s));
+    });
+}
+
+void connection_pool::release(socket&& s_)
+{
+    socket s(move(s_));
+
+    if (!is_reusable(s)) return;
+
+    if (_limits.max_idle_per_peer == 0 || _limits.max_idle == 0) return;
+
+    auto ep = s.remote_endpoint();
+
+    auto p = _by_peer.find(ep);
+
+    if (p != _by_peer.end() && p->second.size() >= _limits.max_idle_per_peer) {
+        erase(p->second.front());
+    }
+
+    if (_idle.size() >= _limits.max_idle) {
+        erase(_idle.begin());
+    }
+
+    _idle.push_back(idle_socket{ep, clock::now(), move(s)});
+    _by_peer[ep].push_back(prev(_idle.end()));
+}
+
+void connection_pool::close()
+{
+    _by_peer.clear();
+    _idle.clear();
+
+    auto connecting = move(_connecting);
+    _connecting.clear();
+
+    for (auto& c : connecting) {
+        c->pool = nullptr;
+        c->timer.cancel();
+        c->s.close();
+    }
+}
+
+connection_pool::~connection_pool()
+{
+    close();
+}
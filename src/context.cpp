@@ -9,6 +9,8 @@
 using namespace std;
 using namespace asio_utp;
 
+const uint8_t context::datagram_marker;
+
 struct context::ticker_type : public enable_shared_from_this<ticker_type> {
     bool _running = false;
     bool _outstanding = false;
@@ -69,11 +71,20 @@ uint64 context::callback_sendto(utp_callback_arguments* a)
 
     sys::error_code ec;
 
-    std::vector<asio::const_buffer> bufs { asio::buffer(a->buf, a->len) };
-    self->_multiplexer->send_to( bufs
-                               , util::to_endpoint(*a->address)
-                               , 0
-                               , ec);
+    // Packets without data (ST_STATE) are acknowledgements.
+    if (a->len >= 20 && (a->buf[0] >> 4) == 2) {
+        ++self->_stats.acks_sent;
+    }
+
+    auto ep = util::to_endpoint(*a->address);
+
+    auto s = a->socket ? (socket_impl*) utp_get_userdata(a->socket) : nullptr;
+
+    if (s && s->_fec_group_size) {
+        self->send_with_fec(ep, a->buf, a->len, s->_fec_group_size, ec);
+    } else {
+        self->_multiplexer->send_to(asio::buffer(a->buf, a->len), ep, 0, ec);
+    }
 
     // The libutp library sometimes calls this function even after the last
     // socket holding this context has received an EOF and closed.
@@ -178,10 +189,22 @@ uint64 context::callback_on_accept(utp_callback_arguments* a)
     return 0;
 }
 
+// Libutp subtracts this from the receive buffer size when advertising its
+// receive window, so data queued in the socket slows down the sender.
+uint64 context::callback_get_read_buffer_size(utp_callback_arguments* a)
+{
+    auto socket = (socket_impl*) utp_get_userdata(a->socket);
+    if (!socket) return 0;
+    return socket->available();
+}
+
 context::context(shared_ptr<udp_multiplexer_impl> m)
     : _multiplexer(std::move(m))
     , _local_endpoint(_multiplexer->local_endpoint())
     , _utp_ctx(utp_init(2 /* version */))
+    , _chunk_pool(new detail::chunk_pool())
+    , _ack_timer(_multiplexer->get_executor())
+    , _fec_timer(_multiplexer->get_executor())
 {
     if (_debug) {
         log(this, " context::context()");
@@ -221,6 +244,7 @@ context::context(shared_ptr<udp_multiplexer_impl> m)
     utp_set_callback(_utp_ctx, UTP_ON_READ,         &callback_on_read);
     utp_set_callback(_utp_ctx, UTP_ON_FIREWALL,     &callback_on_firewall);
     utp_set_callback(_utp_ctx, UTP_ON_ACCEPT,       &callback_on_accept);
+    utp_set_callback(_utp_ctx, UTP_GET_READ_BUFFER_SIZE, &callback_get_read_buffer_size);
 }
 
 void context::register_socket(socket_impl& s) {
@@ -233,6 +257,12 @@ void context::register_socket(socket_impl& s) {
 void context::unregister_socket(socket_impl& s) {
     assert(s._register_hook.is_linked());
     s._register_hook.unlink();
+
+    if (!is_peer(s._remote_endpoint)) {
+        _fec.erase(s._remote_endpoint);
+        forget_seq_nrs(s._remote_endpoint);
+    }
+
     if (_registered_sockets.empty()) stop();
 }
 
@@ -278,11 +308,32 @@ void context::on_read( const sys::error_code& read_ec
     sys::error_code ec;
 
     if (!_multiplexer->available(ec)) {
-        utp_issue_deferred_acks(_utp_ctx);
+        on_read_burst_end();
     }
 
     if (read_ec) return;
 
+    if (size && data[0] == datagram_marker) {
+        on_datagram(ep, data + 1, size - 1);
+    } else if (detail::fec::is_frame(data, size)) {
+        on_fec_frame(ep, data, size);
+    } else {
+        process_utp_packet(ep, data, size);
+    }
+
+    if (!_multiplexer->available(ec)) {
+        on_read_burst_end();
+    }
+
+    if (_outstanding_op_count) start_receiving();
+}
+
+void context::process_utp_packet( const endpoint_type& ep
+                                , const uint8_t* data
+                                , size_t size)
+{
+    bool ack_now = on_utp_packet(ep, data, size);
+
     sockaddr_storage src_addr = util::to_sockaddr(ep);
 
     // XXX: This returns a boolean whether the data were handled or not.
@@ -294,11 +345,230 @@ void context::on_read( const sys::error_code& read_ec
                    , (sockaddr*) &src_addr
                    , util::sockaddr_size(src_addr));
 
-    if (!_multiplexer->available(ec)) {
-        utp_issue_deferred_acks(_utp_ctx);
+    if (ack_now) issue_deferred_acks();
+}
+
+void context::on_fec_frame( const endpoint_type& ep
+                          , const uint8_t* data
+                          , size_t size)
+{
+    using detail::fec;
+
+    // Only the peers of our sockets using FEC get any state, otherwise
+    // anybody could make us buffer their packets.
+    auto p = uses_fec(ep) ? &_fec.find_or_create(ep) : nullptr;
+
+    const uint8_t* packet = nullptr;
+    size_t packet_size = 0;
+    std::vector<uint8_t> recovered;
+
+    // A peer sending frames decodes them as well, in case we forgot its
+    // hello.
+    if (p) p->decodes = true;
+
+    switch (data[0]) {
+        case fec::hello_marker:
+            return;
+        case fec::data_marker:
+            if (size <= fec::data_header_size) return;
+            if (p) {
+                fec::decode_data(*p, data, size, packet, packet_size, recovered);
+            } else {
+                packet = data + fec::data_header_size;
+                packet_size = size - fec::data_header_size;
+            }
+            break;
+        case fec::parity_marker:
+            if (p) fec::decode_parity(*p, data, size, recovered);
+            break;
     }
 
-    if (_outstanding_op_count) start_receiving();
+    // Libutp may close sockets while processing these, so `p` is not to be
+    // used from here on.
+    if (packet) process_utp_packet(ep, packet, packet_size);
+
+    if (!recovered.empty()) {
+        ++_stats.fec_packets_recovered;
+        process_utp_packet(ep, recovered.data(), recovered.size());
+    }
+}
+
+// Only data packets are protected, and only once the peer said it decodes
+// them. A hello is sent first, and again with every SYN in case the first
+// one got lost.
+void context::send_with_fec( const endpoint_type& ep
+                           , const uint8_t* packet
+                           , size_t size
+                           , size_t group_size
+                           , sys::error_code& ec)
+{
+    using detail::fec;
+
+    auto& p = _fec.find_or_create(ep);
+
+    bool is_data = size >= 20 && (packet[0] >> 4) == 0 /* ST_DATA */;
+    bool is_syn  = size >= 20 && (packet[0] >> 4) == 4 /* ST_SYN */;
+
+    if (!p.hello_sent || is_syn) {
+        p.hello_sent = true;
+        uint8_t hello = fec::hello_marker;
+        sys::error_code ec_ignored;
+        _multiplexer->send_to(asio::buffer(&hello, 1), ep, 0, ec_ignored);
+    }
+
+    if (!p.decodes || !is_data) {
+        _multiplexer->send_to(asio::buffer(packet, size), ep, 0, ec);
+        return;
+    }
+
+    if (p.tx_count >= group_size) send_fec_parity(ep, p);
+
+    fec::encode(p, packet, size, _fec_tx_buffer);
+    _multiplexer->send_to(asio::buffer(_fec_tx_buffer), ep, 0, ec);
+
+    if (p.tx_count >= group_size) {
+        return send_fec_parity(ep, p);
+    }
+
+    if (_fec_timer_armed) return;
+
+    // A group cut short by a pause in sending gets its parity a little later.
+    _fec_timer_armed = true;
+    _fec_timer.expires_after(chrono::milliseconds(10));
+    _fec_timer.async_wait([this, wself = asio_utp::weak_from_this(this)]
+                          (const sys::error_code& ec) {
+        if (ec || wself.expired()) return;
+        _fec_timer_armed = false;
+        flush_fec_groups();
+    });
+}
+
+void context::flush_fec_groups()
+{
+    _fec.for_each([&] (const endpoint_type& ep, detail::fec::peer& p) {
+        if (p.tx_count < detail::fec::min_flushed_group_size) return;
+        send_fec_parity(ep, p);
+    });
+}
+
+void context::send_fec_parity(const endpoint_type& ep, detail::fec::peer& p)
+{
+    if (!detail::fec::take_parity(p, _fec_tx_buffer)) return;
+
+    ++_stats.fec_parity_packets_sent;
+
+    sys::error_code ec;
+    _multiplexer->send_to(asio::buffer(_fec_tx_buffer), ep, 0, ec);
+}
+
+// Counts data packets and returns whether their acknowledgements should go
+// out right away (with `ack_frequency` set): because there is enough of them,
+// or because this one didn't follow the previous one from its connection.
+bool context::on_utp_packet( const endpoint_type& ep
+                           , const uint8_t* data
+                           , size_t size)
+{
+    // The uTP header is 20 bytes, type in the high nibble of the first one
+    // (0 is ST_DATA), connection id at 2 and sequence number at 16.
+    if (size < 20 || (data[0] >> 4) != 0) return false;
+
+    ++_stats.data_packets_received;
+
+    if (_ack_frequency == 0) return false;
+
+    uint16_t conn_id = (data[2] << 8) | data[3];
+    uint16_t seq_nr = (data[16] << 8) | data[17];
+
+    auto key = make_pair(ep, conn_id);
+    auto i = _last_seq_nrs.find(key);
+
+    bool in_order = true;
+
+    if (i != _last_seq_nrs.end()) {
+        in_order = uint16_t(i->second + 1) == seq_nr;
+        i->second = seq_nr;
+    } else if (is_peer(ep)) {
+        // Only for peers with a socket, as those get forgotten again.
+        _last_seq_nrs.emplace(key, seq_nr);
+    }
+
+    return !in_order || ++_unacked_packets >= _ack_frequency;
+}
+
+// Nothing more to read from the UDP socket for now.
+void context::on_read_burst_end()
+{
+    if (_ack_frequency == 0 || _unacked_packets == 0) {
+        return issue_deferred_acks();
+    }
+
+    if (_ack_timer_armed) return;
+
+    _ack_timer_armed = true;
+    _ack_timer.expires_after(_max_ack_delay);
+    _ack_timer.async_wait([this, wself = asio_utp::weak_from_this(this)]
+                          (const sys::error_code& ec) {
+        if (ec || wself.expired()) return;
+        _ack_timer_armed = false;
+        issue_deferred_acks();
+    });
+}
+
+bool context::uses_fec(const endpoint_type& ep) const
+{
+    for (auto& s : _registered_sockets) {
+        if (s._fec_group_size && s._remote_endpoint == ep) return true;
+    }
+
+    // The hello comes before the SYN, so before the socket is accepted.
+    for (auto& s : _accepting_sockets) {
+        if (s._fec_group_size) return true;
+    }
+
+    return false;
+}
+
+bool context::is_peer(const endpoint_type& ep) const
+{
+    for (auto& s : _registered_sockets) {
+        if (s._remote_endpoint == ep) return true;
+    }
+    return false;
+}
+
+// Libutp doesn't tell us connection ids, so this goes by peer endpoint.
+void context::forget_seq_nrs(const endpoint_type& ep)
+{
+    auto i = _last_seq_nrs.lower_bound(make_pair(ep, uint16_t(0)));
+
+    while (i != _last_seq_nrs.end() && i->first.first == ep) {
+        i = _last_seq_nrs.erase(i);
+    }
+}
+
+void context::issue_deferred_acks()
+{
+    utp_issue_deferred_acks(_utp_ctx);
+
+    _unacked_packets = 0;
+
+    if (_ack_timer_armed) {
+        _ack_timer_armed = false;
+        _ack_timer.cancel();
+    }
+}
+
+// Datagrams are matched to connections by the sender's endpoint. With more
+// than one connection to the same peer endpoint the first one gets them.
+void context::on_datagram( const endpoint_type& ep
+                         , const uint8_t* data
+                         , size_t size)
+{
+    for (auto& s : _registered_sockets) {
+        if (!s._utp_socket || s._closed) continue;
+        if (s._remote_endpoint != ep) continue;
+        return s.on_datagram(data, size);
+    }
 }
 
 context::executor_type context::get_executor()
@@ -315,6 +585,8 @@ context::~context()
 
     utp_destroy(_utp_ctx);
 
+    _chunk_pool->orphan();
+
     auto& s = asio::use_service<service>(_multiplexer->get_executor().context());
     s.erase_context(_local_endpoint);
 }
@@ -8,6 +8,9 @@
 #include "socket_impl.hpp"
 #include "udp_multiplexer_impl.hpp"
 #include "intrusive_list.hpp"
+#include "chunk_pool.hpp"
+#include "path_metrics_cache.hpp"
+#include "fec.hpp"
 
 #include <utp.h>
 #include <asio_utp/socket.hpp>
@@ -30,8 +33,26 @@ public:
 
     executor_type get_executor();
 
+    detail::chunk_pool& chunk_pool() { return *_chunk_pool; }
+
+    detail::path_metrics_cache& path_metrics() { return _path_metrics; }
+
+    // See `asio_utp::ack_frequency`.
+    void ack_frequency(size_t n) { _ack_frequency = n; }
+    size_t ack_frequency() const { return _ack_frequency; }
+
+    void max_ack_delay(std::chrono::milliseconds d) { _max_ack_delay = d; }
+    std::chrono::milliseconds max_ack_delay() const { return _max_ack_delay; }
+
+    const context_stats& stats() const { return _stats; }
+
     ~context();
 
+    // First byte of the datagrams sent with `socket::async_send_datagram`.
+    // The low nibble is where uTP packets carry their version (1), so these
+    // never reach libutp.
+    static const uint8_t datagram_marker = 0x0F;
+
     static std::shared_ptr<context>
         get_or_create(asio::io_context&, const endpoint_type&);
 
@@ -54,6 +75,25 @@ private:
     void stop();
     void start_reading();
 
+    void on_datagram(const endpoint_type&, const uint8_t*, size_t);
+
+    void process_utp_packet(const endpoint_type&, const uint8_t*, size_t);
+    void on_fec_frame(const endpoint_type&, const uint8_t*, size_t);
+    void send_with_fec( const endpoint_type&
+                      , const uint8_t*
+                      , size_t
+                      , size_t group_size
+                      , sys::error_code&);
+    void send_fec_parity(const endpoint_type&, detail::fec::peer&);
+    void flush_fec_groups();
+    bool uses_fec(const endpoint_type&) const;
+
+    bool on_utp_packet(const endpoint_type&, const uint8_t*, size_t);
+    void on_read_burst_end();
+    void issue_deferred_acks();
+    void forget_seq_nrs(const endpoint_type&);
+    bool is_peer(const endpoint_type&) const;
+
     void on_read( const sys::error_code& ec
                 , const endpoint_type& ep
                 , const uint8_t* data
@@ -66,6 +106,7 @@ private:
     static uint64 callback_on_read(utp_callback_arguments*);
     static uint64 callback_on_firewall(utp_callback_arguments*);
     static uint64 callback_on_accept(utp_callback_arguments*);
+    static uint64 callback_get_read_buffer_size(utp_callback_arguments*);
 
     static std::map<endpoint_type, std::weak_ptr<context>>& contexts();
 
@@ -75,6 +116,28 @@ private:
     endpoint_type _local_endpoint;
     utp_context* _utp_ctx;
 
+    // Orphaned (not deleted) on destruction, chunks may still be in use.
+    detail::chunk_pool* _chunk_pool;
+
+    detail::path_metrics_cache _path_metrics;
+
+    // Deferred acknowledgements, see `asio_utp::ack_frequency`. The sequence
+    // numbers are those of the last data packet per (peer, connection id),
+    // kept until the last socket connected to the peer goes away.
+    size_t _ack_frequency = 0;
+    std::chrono::milliseconds _max_ack_delay{10};
+    size_t _unacked_packets = 0;
+    std::map<std::pair<endpoint_type, uint16_t>, uint16_t> _last_seq_nrs;
+    asio::steady_timer _ack_timer;
+    bool _ack_timer_armed = false;
+
+    detail::fec _fec;
+    std::vector<uint8_t> _fec_tx_buffer;
+    asio::steady_timer _fec_timer;
+    bool _fec_timer_armed = false;
+
+    context_stats _stats;
+
     // Registered sockets are all those that use `this`.
     intrusive::list<socket_impl, &socket_impl::_register_hook> _registered_sockets;
     intrusive::list<socket_impl, &socket_impl::_accept_hook> _accepting_sockets;
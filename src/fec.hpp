@@ -0,0 +1,322 @@
+#pragma once
+
+#include <boost/asio/ip/udp.hpp>
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <vector>
+
+namespace asio_utp { namespace detail {
+
+// XOR forward error correction over groups of uTP packets sent to the same
+// peer endpoint, see `asio_utp::forward_error_correction`. This only does the
+// framing and the coding, the context decides what goes through it.
+//
+// Frames start with a byte whose low nibble is 0xF (where uTP packets carry
+// their version) so that they never reach libutp:
+//
+//   hello:  [0x1F]
+//   data:   [0x2F][group:16][index:8] uTP packet
+//   parity: [0x3F][group:16][count:8][length xor:16] XOR of the packets
+//
+// A peer which sends us a hello decodes the frames, so only then do we start
+// wrapping packets to it. The XOR of a group's packets (zero padded to the
+// longest one) rebuilds any single packet of the group that went missing.
+class fec {
+public:
+    using endpoint_type = boost::asio::ip::udp::endpoint;
+
+    static const uint8_t hello_marker  = 0x1F;
+    static const uint8_t data_marker   = 0x2F;
+    static const uint8_t parity_marker = 0x3F;
+
+    static const size_t data_header_size = 4;
+    static const size_t parity_header_size = 6;
+
+    static const size_t max_group_size = 255;
+
+    // Smallest group whose parity goes out before the group is full. Parity
+    // for a single packet would just be a copy of it.
+    static const size_t min_flushed_group_size = 2;
+
+    // Groups a receiver keeps waiting for their parity (or missing packets).
+    static const size_t max_rx_groups = 4;
+
+    // Bytes a receiver buffers for one group and for all groups of a peer.
+    // A group going over either is given up on, its packets still go through
+    // but a lost one isn't recovered.
+    static const size_t max_rx_group_bytes = 64 * 1024;
+    static const size_t max_rx_peer_bytes = 128 * 1024;
+
+    // Peers are forgotten when their last connection goes away. Past this
+    // many, the least recently used one is forgotten to make room.
+    static const size_t max_peers = 256;
+
+    struct rx_group {
+        uint16_t id;
+        // Indexed by the packet's index in the group, empty while missing.
+        std::vector<std::vector<uint8_t>> packets;
+        size_t received = 0;
+        size_t bytes = 0;
+
+        // Zero until the parity frame arrives.
+        uint8_t count = 0;
+        uint16_t length_xor = 0;
+        std::vector<uint8_t> parity;
+
+        bool done = false;
+    };
+
+    struct peer {
+        bool hello_sent = false;
+        bool decodes = false;
+
+        uint16_t tx_group = 0;
+        uint8_t tx_count = 0;
+        uint16_t tx_length_xor = 0;
+        std::vector<uint8_t> tx_parity;
+
+        // Most recent last.
+        std::deque<rx_group> rx_groups;
+        size_t rx_bytes = 0;
+
+        uint64_t last_used = 0;
+    };
+
+public:
+    static bool is_frame(const uint8_t* data, size_t size)
+    {
+        return size && (data[0] == hello_marker
+                     || data[0] == data_marker
+                     || data[0] == parity_marker);
+    }
+
+    peer& find_or_create(const endpoint_type& ep)
+    {
+        auto i = _peers.find(ep);
+
+        if (i == _peers.end()) {
+            if (_peers.size() >= max_peers) evict_least_recently_used();
+            i = _peers.emplace(ep, peer()).first;
+        }
+
+        i->second.last_used = ++_clock;
+        return i->second;
+    }
+
+    peer* find(const endpoint_type& ep)
+    {
+        auto i = _peers.find(ep);
+        if (i == _peers.end()) return nullptr;
+        return &i->second;
+    }
+
+    void erase(const endpoint_type& ep) { _peers.erase(ep); }
+
+    template<class F> void for_each(F&& f)
+    {
+        for (auto& e : _peers) f(e.first, e.second);
+    }
+
+    // Writes the data frame for `packet` to `out` and adds the packet to the
+    // current group.
+    static void encode( peer& p
+                      , const uint8_t* packet
+                      , size_t size
+                      , std::vector<uint8_t>& out)
+    {
+        out.resize(data_header_size + size);
+        out[0] = data_marker;
+        out[1] = p.tx_group >> 8;
+        out[2] = p.tx_group & 0xff;
+        out[3] = p.tx_count;
+        std::copy(packet, packet + size, out.begin() + data_header_size);
+
+        if (p.tx_parity.size() < size) p.tx_parity.resize(size, 0);
+
+        for (size_t i = 0; i < size; ++i) p.tx_parity[i] ^= packet[i];
+
+        p.tx_length_xor ^= uint16_t(size);
+        ++p.tx_count;
+    }
+
+    // Writes the parity frame of the current group to `out` and starts a new
+    // group. False if the current group is empty.
+    static bool take_parity(peer& p, std::vector<uint8_t>& out)
+    {
+        if (p.tx_count == 0) return false;
+
+        out.resize(parity_header_size + p.tx_parity.size());
+        out[0] = parity_marker;
+        out[1] = p.tx_group >> 8;
+        out[2] = p.tx_group & 0xff;
+        out[3] = p.tx_count;
+        out[4] = p.tx_length_xor >> 8;
+        out[5] = p.tx_length_xor & 0xff;
+        std::copy( p.tx_parity.begin(), p.tx_parity.end()
+                 , out.begin() + parity_header_size);
+
+        ++p.tx_group;
+        p.tx_count = 0;
+        p.tx_length_xor = 0;
+        p.tx_parity.clear();
+
+        return true;
+    }
+
+    // Returns the uTP packet inside a data frame through `packet` (false if
+    // the frame is malformed), and through `recovered` a packet of the same
+    // group rebuilt thanks to it, if any.
+    static bool decode_data( peer& p
+                           , const uint8_t* data
+                           , size_t size
+                           , const uint8_t*& packet
+                           , size_t& packet_size
+                           , std::vector<uint8_t>& recovered)
+    {
+        if (size <= data_header_size) return false;
+
+        uint8_t index = data[3];
+
+        if (index >= max_group_size) return false;
+
+        packet = data + data_header_size;
+        packet_size = size - data_header_size;
+
+        auto& g = group(p, (data[1] << 8) | data[2]);
+
+        if (g.done) return true;
+
+        // Past the count the sender gave, this can't be part of the parity.
+        if (g.count && index >= g.count) return true;
+
+        if (g.packets.size() <= index) g.packets.resize(index + 1);
+
+        auto& slot = g.packets[index];
+
+        if (!slot.empty()) return true;
+
+        if (!reserve(p, g, packet_size)) {
+            finish(p, g);
+            return true;
+        }
+
+        slot.assign(packet, packet + packet_size);
+        ++g.received;
+
+        maybe_recover(p, g, recovered);
+        return true;
+    }
+
+    // Returns false if the frame is malformed.
+    static bool decode_parity( peer& p
+                             , const uint8_t* data
+                             , size_t size
+                             , std::vector<uint8_t>& recovered)
+    {
+        if (size < parity_header_size || data[3] == 0) return false;
+
+        auto& g = group(p, (data[1] << 8) | data[2]);
+
+        if (g.done || g.count) return true;
+
+        if (!reserve(p, g, size - parity_header_size)) {
+            finish(p, g);
+            return true;
+        }
+
+        g.count = data[3];
+        g.length_xor = (data[4] << 8) | data[5];
+        g.parity.assign(data + parity_header_size, data + size);
+
+        maybe_recover(p, g, recovered);
+        return true;
+    }
+
+private:
+    static rx_group& group(peer& p, uint16_t id)
+    {
+        for (auto& g : p.rx_groups) {
+            if (g.id == id) return g;
+        }
+
+        if (p.rx_groups.size() == max_rx_groups) {
+            p.rx_bytes -= p.rx_groups.front().bytes;
+            p.rx_groups.pop_front();
+        }
+
+        p.rx_groups.push_back(rx_group());
+        p.rx_groups.back().id = id;
+        return p.rx_groups.back();
+    }
+
+    static bool reserve(peer& p, rx_group& g, size_t n)
+    {
+        if (g.bytes + n > max_rx_group_bytes) return false;
+        if (p.rx_bytes + n > max_rx_peer_bytes) return false;
+        g.bytes += n;
+        p.rx_bytes += n;
+        return true;
+    }
+
+    // Frees what the group buffers, further frames of it are ignored.
+    static void finish(peer& p, rx_group& g)
+    {
+        g.done = true;
+        p.rx_bytes -= g.bytes;
+        g.bytes = 0;
+        std::vector<std::vector<uint8_t>>().swap(g.packets);
+        std::vector<uint8_t>().swap(g.parity);
+    }
+
+    static void maybe_recover( peer& p
+                             , rx_group& g
+                             , std::vector<uint8_t>& recovered)
+    {
+        if (!g.count || g.received + 1 < g.count) return;
+
+        if (g.received + 1 == g.count) recover(g, recovered);
+
+        finish(p, g);
+    }
+
+    static void recover(const rx_group& g, std::vector<uint8_t>& recovered)
+    {
+        size_t missing = g.count;
+        uint16_t length = g.length_xor;
+
+        for (size_t i = 0; i < g.count; ++i) {
+            if (i >= g.packets.size() || g.packets[i].empty()) missing = i;
+            else length ^= uint16_t(g.packets[i].size());
+        }
+
+        // Indices beyond `count` mean a broken or confused sender.
+        if (missing == g.count || length == 0 || length > g.parity.size()) {
+            return;
+        }
+
+        recovered.assign(g.parity.begin(), g.parity.begin() + length);
+
+        for (auto& packet : g.packets) {
+            size_t n = std::min(packet.size(), recovered.size());
+            for (size_t i = 0; i < n; ++i) recovered[i] ^= packet[i];
+        }
+    }
+
+    void evict_least_recently_used()
+    {
+        auto lru = _peers.begin();
+
+        for (auto i = _peers.begin(); i != _peers.end(); ++i) {
+            if (i->second.last_used < lru->second.last_used) lru = i;
+        }
+
+        if (lru != _peers.end()) _peers.erase(lru);
+    }
+
+private:
+    std::map<endpoint_type, peer> _peers;
+    uint64_t _clock = 0;
+};
+
+}} // namespaces
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <asio_utp/socket.hpp>
+#include <boost/asio/ip/address.hpp>
+#include <chrono>
+#include <list>
+#include <map>
+
+namespace asio_utp { namespace detail {
+
+// What a context remembers about the paths to the addresses it talked to,
+// similar to the Linux TCP metrics cache. Keyed by remote address (not
+// port), bounded in size, entries expire `expiry` after their last update.
+class path_metrics_cache {
+public:
+    using clock = std::chrono::steady_clock;
+    using address_type = boost::asio::ip::address;
+
+    static const size_t max_entries = 1024;
+
+public:
+    bool find(const address_type& a, path_metrics& out)
+    {
+        auto i = _index.find(a);
+        if (i == _index.end()) return false;
+
+        if (clock::now() - i->second->metrics.updated > _expiry) {
+            _entries.erase(i->second);
+            _index.erase(i);
+            return false;
+        }
+
+        out = i->second->metrics;
+        return true;
+    }
+
+    // Smoothed as in RFC 6298.
+    void add_rtt_sample(const address_type& a, std::chrono::microseconds rtt)
+    {
+        auto& m = touch(a);
+
+        if (m.srtt.count() == 0) {
+            m.srtt = rtt;
+            m.rttvar = rtt / 2;
+        } else {
+            auto diff = m.srtt > rtt ? m.srtt - rtt : rtt - m.srtt;
+            m.rttvar = (3 * m.rttvar + diff) / 4;
+            m.srtt = (7 * m.srtt + rtt) / 8;
+        }
+    }
+
+    // Zero values are what libutp reports when it doesn't know, no entry is
+    // created for those alone.
+    void add_close_sample( const address_type& a
+                         , std::chrono::microseconds queuing_delay
+                         , size_t mtu)
+    {
+        if (!queuing_delay.count() && !mtu) return;
+
+        auto& m = touch(a);
+        if (queuing_delay.count()) m.queuing_delay = queuing_delay;
+        if (mtu) m.mtu = mtu;
+    }
+
+    void expiry(clock::duration d) { _expiry = d; }
+    clock::duration expiry() const { return _expiry; }
+
+private:
+    struct entry {
+        address_type address;
+        path_metrics metrics;
+    };
+
+    using entries = std::list<entry>;
+
+    // Returns the entry for `a` (created if needed) marked as most recently
+    // updated, evicting the least recently updated one when full.
+    path_metrics& touch(const address_type& a)
+    {
+        auto i = _index.find(a);
+
+        if (i != _index.end()) {
+            _entries.splice(_entries.end(), _entries, i->second);
+        } else {
+            if (_entries.size() == max_entries) {
+                _index.erase(_entries.front().address);
+                _entries.pop_front();
+            }
+            _entries.push_back(entry{a, path_metrics()});
+            i = _index.emplace(a, std::prev(_entries.end())).first;
+        }
+
+        auto& m = i->second->metrics;
+        m.updated = clock::now();
+        return m;
+    }
+
+private:
+    clock::duration _expiry = std::chrono::minutes(10);
+
+    // Least recently updated first.
+    entries _entries;
+    std::map<address_type, entries::iterator> _index;
+};
+
+}} // namespaces
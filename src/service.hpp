@@ -1,5 +1,8 @@
 #pragma once
 
+// Some Boost versions' asio/awaitable.hpp uses std::exchange without
+// including <utility>, which breaks C++20 builds.
+#include <utility>
 #include <boost/asio.hpp>
 #include "namespaces.hpp"
 
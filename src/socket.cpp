@@ -1,19 +1,19 @@
 #include <asio_utp/socket.hpp>
 #include "namespaces.hpp"
 #include "socket_impl.hpp"
+#include "context.hpp"
 
 using namespace std;
 using namespace asio_utp;
+using detail::socket_base;
 
-socket::socket(boost::asio::io_context& ioc)
-    : _ex(ioc.get_executor())
-{}
+const size_t socket_base::max_datagram_size;
 
-socket::socket(const boost::asio::executor& ex)
-    : _ex(ex)
+socket_base::socket_base(const boost::asio::executor& ex)
+    : _impl_ex(ex)
 {}
 
-void socket::bind(const endpoint_type& ep, sys::error_code& ec)
+void socket_base::bind(const endpoint_type& ep, sys::error_code& ec)
 {
     if (_socket_impl) {
         // TODO: Is this the correct error code?
@@ -27,7 +27,7 @@ void socket::bind(const endpoint_type& ep, sys::error_code& ec)
     _socket_impl = move(impl);
 }
 
-void socket::bind(const udp_multiplexer& m, sys::error_code& ec)
+void socket_base::bind(const detail::udp_multiplexer_base& m, sys::error_code& ec)
 {
     if (_socket_impl) {
         // TODO: Is this the correct error code?
@@ -39,8 +39,8 @@ void socket::bind(const udp_multiplexer& m, sys::error_code& ec)
     _socket_impl->bind(m);
 }
 
-socket::socket(socket&& other)
-    : _ex(move(other._ex))
+socket_base::socket_base(socket_base&& other)
+    : _impl_ex(move(other._impl_ex))
     , _socket_impl(move(other._socket_impl))
 {
     if (_socket_impl) {
@@ -48,61 +48,385 @@ socket::socket(socket&& other)
     }
 }
 
-asio_utp::socket& socket::operator=(socket&& other)
+socket_base& socket_base::operator=(socket_base&& other)
 {
-    assert(!_ex || !other._ex || _ex == other._ex);
+    if (this == &other) return *this;
+
+    assert(!_impl_ex || !other._impl_ex || _impl_ex == other._impl_ex);
+
+    // Same as the destructor does with what we're replacing.
+    if (is_open()) _socket_impl->close();
 
-    _ex = move(other._ex);
+    _impl_ex = move(other._impl_ex);
     _socket_impl = move(other._socket_impl);
 
     if (_socket_impl) {
-        assert(other._socket_impl->_owner);
+        assert(_socket_impl->_owner);
         _socket_impl->_owner = this;
     }
 
     return *this;
 }
 
-boost::asio::ip::udp::endpoint socket::local_endpoint() const
+boost::asio::ip::udp::endpoint socket_base::local_endpoint() const
 {
     assert(_socket_impl); // TODO: throw
     return _socket_impl->local_endpoint();
 }
 
-boost::asio::ip::udp::endpoint socket::remote_endpoint() const
+boost::asio::ip::udp::endpoint socket_base::remote_endpoint() const
 {
     assert(_socket_impl); // TODO: throw
     return _socket_impl->remote_endpoint();
 }
 
-bool socket::is_open() const {
+bool socket_base::is_open() const {
     return _socket_impl && _socket_impl->is_open();
 }
 
-void socket::close()
+void socket_base::set_option(const cork& opt, sys::error_code& ec)
 {
-    if (!is_open()) return;
+    if (!_socket_impl) {
+        ec = asio::error::bad_descriptor;
+        return;
+    }
 
-    _socket_impl->close();
-    _socket_impl = nullptr;
+    _socket_impl->set_cork(opt.value());
 }
 
-socket::~socket()
+void socket_base::get_option(cork& opt, sys::error_code& ec) const
 {
-    if (is_open()) _socket_impl->close();
+    if (!_socket_impl) {
+        ec = asio::error::bad_descriptor;
+        return;
+    }
+
+    opt = cork(_socket_impl->_cork);
 }
 
-void socket::do_connect(const endpoint_type& ep_, handler<>&& h)
+void socket_base::set_option(const coalesce_delay& opt, sys::error_code& ec)
 {
     if (!_socket_impl) {
-        return h.post(asio::error::bad_descriptor);
+        ec = asio::error::bad_descriptor;
+        return;
     }
 
-    auto ep = ep_;
+    _socket_impl->set_coalesce_delay(opt.value());
+}
+
+void socket_base::get_option(coalesce_delay& opt, sys::error_code& ec) const
+{
+    if (!_socket_impl) {
+        ec = asio::error::bad_descriptor;
+        return;
+    }
 
-    // Libutp can't connect to an unspecified IP address. But it seems
-    // (https://tools.ietf.org/html/rfc5735#section-3) it's OK if we connect to
-    // "this" host instead.
+    opt = coalesce_delay(_socket_impl->_coalesce_delay);
+}
+
+void socket_base::set_option(const immediate_completion& opt, sys::error_code& ec)
+{
+    if (!_socket_impl) {
+        ec = asio::error::bad_descriptor;
+        return;
+    }
+
+    _socket_impl->_immediate_completion = opt.value();
+}
+
+void socket_base::get_option(immediate_completion& opt, sys::error_code& ec) const
+{
+    if (!_socket_impl) {
+        ec = asio::error::bad_descriptor;
+        return;
+    }
+
+    opt = immediate_completion(_socket_impl->_immediate_completion);
+}
+
+void socket_base::set_option(const max_message_size& opt, sys::error_code& ec)
+{
+    if (!_socket_impl) {
+        ec = asio::error::bad_descriptor;
+        return;
+    }
+
+    _socket_impl->_max_message_size = opt.value();
+}
+
+void socket_base::get_option(max_message_size& opt, sys::error_code& ec) const
+{
+    if (!_socket_impl) {
+        ec = asio::error::bad_descriptor;
+        return;
+    }
+
+    opt = max_message_size(_socket_impl->_max_message_size);
+}
+
+void socket_base::set_option(const server_first& opt, sys::error_code& ec)
+{
+    if (!_socket_impl) {
+        ec = asio::error::bad_descriptor;
+        return;
+    }
+
+    _socket_impl->_server_first = opt.value();
+}
+
+void socket_base::get_option(server_first& opt, sys::error_code& ec) const
+{
+    if (!_socket_impl) {
+        ec = asio::error::bad_descriptor;
+        return;
+    }
+
+    opt = server_first(_socket_impl->_server_first);
+}
+
+void socket_base::set_option(const path_metrics_expiry& opt, sys::error_code& ec)
+{
+    if (!_socket_impl) {
+        ec = asio::error::bad_descriptor;
+        return;
+    }
+
+    _socket_impl->_context->path_metrics().expiry(opt.value());
+}
+
+void socket_base::get_option(path_metrics_expiry& opt, sys::error_code& ec) const
+{
+    if (!_socket_impl) {
+        ec = asio::error::bad_descriptor;
+        return;
+    }
+
+    auto d = _socket_impl->_context->path_metrics().expiry();
+    opt = path_metrics_expiry(chrono::duration_cast<chrono::seconds>(d));
+}
+
+void socket_base::set_option(const target_delay& opt, sys::error_code& ec)
+{
+    if (!_socket_impl) {
+        ec = asio::error::bad_descriptor;
+        return;
+    }
+
+    int v;
+
+    if (!util::to_utp_option_value(opt.value(), v)) {
+        ec = asio::error::invalid_argument;
+        return;
+    }
+
+    _socket_impl->set_utp_option(UTP_TARGET_DELAY, v);
+}
+
+void socket_base::get_option(target_delay& opt, sys::error_code& ec) const
+{
+    if (!_socket_impl) {
+        ec = asio::error::bad_descriptor;
+        return;
+    }
+
+    auto us = chrono::microseconds(_socket_impl->get_utp_option(UTP_TARGET_DELAY));
+    opt = target_delay(chrono::duration_cast<chrono::milliseconds>(us));
+}
+
+void socket_base::set_option(const send_buffer_size& opt, sys::error_code& ec)
+{
+    if (!_socket_impl) {
+        ec = asio::error::bad_descriptor;
+        return;
+    }
+
+    int v;
+
+    if (!util::to_utp_option_value(opt.value(), v)) {
+        ec = asio::error::invalid_argument;
+        return;
+    }
+
+    _socket_impl->set_utp_option(UTP_SNDBUF, v);
+}
+
+void socket_base::get_option(send_buffer_size& opt, sys::error_code& ec) const
+{
+    if (!_socket_impl) {
+        ec = asio::error::bad_descriptor;
+        return;
+    }
+
+    opt = send_buffer_size(_socket_impl->get_utp_option(UTP_SNDBUF));
+}
+
+void socket_base::set_option(const receive_buffer_size& opt, sys::error_code& ec)
+{
+    if (!_socket_impl) {
+        ec = asio::error::bad_descriptor;
+        return;
+    }
+
+    int v;
+
+    if (!util::to_utp_option_value(opt.value(), v)) {
+        ec = asio::error::invalid_argument;
+        return;
+    }
+
+    _socket_impl->set_utp_option(UTP_RCVBUF, v);
+}
+
+void socket_base::get_option(receive_buffer_size& opt, sys::error_code& ec) const
+{
+    if (!_socket_impl) {
+        ec = asio::error::bad_descriptor;
+        return;
+    }
+
+    opt = receive_buffer_size(_socket_impl->get_utp_option(UTP_RCVBUF));
+}
+
+void socket_base::set_option(const congestion_control& opt, sys::error_code& ec)
+{
+    if (!_socket_impl) {
+        ec = asio::error::bad_descriptor;
+        return;
+    }
+
+    _socket_impl->set_congestion_control(opt.value());
+}
+
+void socket_base::get_option(congestion_control& opt, sys::error_code& ec) const
+{
+    if (!_socket_impl) {
+        ec = asio::error::bad_descriptor;
+        return;
+    }
+
+    opt = congestion_control(_socket_impl->_congestion_control);
+}
+
+void socket_base::set_option(const forward_error_correction& opt, sys::error_code& ec)
+{
+    if (!_socket_impl) {
+        ec = asio::error::bad_descriptor;
+        return;
+    }
+
+    if (opt.value() > detail::fec::max_group_size) {
+        ec = asio::error::invalid_argument;
+        return;
+    }
+
+    _socket_impl->_fec_group_size = opt.value();
+}
+
+void socket_base::get_option(forward_error_correction& opt, sys::error_code& ec) const
+{
+    if (!_socket_impl) {
+        ec = asio::error::bad_descriptor;
+        return;
+    }
+
+    opt = forward_error_correction(_socket_impl->_fec_group_size);
+}
+
+void socket_base::set_option(const ack_frequency& opt, sys::error_code& ec)
+{
+    if (!_socket_impl) {
+        ec = asio::error::bad_descriptor;
+        return;
+    }
+
+    _socket_impl->_context->ack_frequency(opt.value());
+}
+
+void socket_base::get_option(ack_frequency& opt, sys::error_code& ec) const
+{
+    if (!_socket_impl) {
+        ec = asio::error::bad_descriptor;
+        return;
+    }
+
+    opt = ack_frequency(_socket_impl->_context->ack_frequency());
+}
+
+void socket_base::set_option(const max_ack_delay& opt, sys::error_code& ec)
+{
+    if (!_socket_impl) {
+        ec = asio::error::bad_descriptor;
+        return;
+    }
+
+    if (opt.value().count() <= 0) {
+        ec = asio::error::invalid_argument;
+        return;
+    }
+
+    _socket_impl->_context->max_ack_delay(opt.value());
+}
+
+void socket_base::get_option(max_ack_delay& opt, sys::error_code& ec) const
+{
+    if (!_socket_impl) {
+        ec = asio::error::bad_descriptor;
+        return;
+    }
+
+    opt = max_ack_delay(_socket_impl->_context->max_ack_delay());
+}
+
+context_stats socket_base::get_context_stats(sys::error_code& ec) const
+{
+    if (!_socket_impl) {
+        ec = asio::error::bad_descriptor;
+        return {};
+    }
+
+    return _socket_impl->_context->stats();
+}
+
+bool socket_base::cached_path_metrics( const asio::ip::address& a
+                                     , path_metrics& m
+                                     , sys::error_code& ec) const
+{
+    if (!_socket_impl) {
+        ec = asio::error::bad_descriptor;
+        return false;
+    }
+
+    return _socket_impl->_context->path_metrics().find(a, m);
+}
+
+void socket_base::flush(sys::error_code& ec)
+{
+    if (!_socket_impl) {
+        ec = asio::error::bad_descriptor;
+        return;
+    }
+
+    _socket_impl->flush_coalesced();
+}
+
+void socket_base::close()
+{
+    if (!is_open()) return;
+
+    _socket_impl->close();
+    _socket_impl = nullptr;
+}
+
+socket_base::~socket_base()
+{
+    if (is_open()) _socket_impl->close();
+}
+
+// Libutp can't connect to an unspecified IP address. But it seems
+// (https://tools.ietf.org/html/rfc5735#section-3) it's OK if we connect to
+// "this" host instead.
+static socket_base::endpoint_type connectable(socket_base::endpoint_type ep)
+{
     if (ep.address().is_unspecified()) {
         if (ep.address().is_v4()) {
             ep.address(asio::ip::address_v4::loopback());
@@ -111,10 +435,28 @@ void socket::do_connect(const endpoint_type& ep_, handler<>&& h)
         }
     }
 
-    _socket_impl->do_connect(ep, std::move(move(h)));
+    return ep;
+}
+
+void socket_base::do_connect(const endpoint_type& ep, handler<>&& h)
+{
+    if (!_socket_impl) {
+        return h.post(asio::error::bad_descriptor);
+    }
+
+    _socket_impl->do_connect(connectable(ep), std::move(h));
 }
 
-void socket::do_accept(handler<>&& h)
+void socket_base::do_connect_with_data(const endpoint_type& ep, handler<size_t>&& h)
+{
+    if (!_socket_impl) {
+        return h.post(asio::error::bad_descriptor, 0);
+    }
+
+    _socket_impl->do_connect_with_data(connectable(ep), std::move(h));
+}
+
+void socket_base::do_accept(handler<>&& h)
 {
     if (!_socket_impl) {
         return h.post(asio::error::bad_descriptor);
@@ -123,7 +465,7 @@ void socket::do_accept(handler<>&& h)
     _socket_impl->do_accept(std::move(h));
 }
 
-void socket::do_write(handler<size_t>&& h)
+void socket_base::do_write(handler<size_t>&& h)
 {
     if (!_socket_impl) {
         return h.post(asio::error::bad_descriptor, 0);
@@ -132,7 +474,7 @@ void socket::do_write(handler<size_t>&& h)
     _socket_impl->do_write(std::move(h));
 }
 
-void socket::do_read(handler<size_t>&& h)
+void socket_base::do_read(handler<size_t>&& h)
 {
     if (!_socket_impl) {
         return h.post(asio::error::bad_descriptor, 0);
@@ -141,14 +483,183 @@ void socket::do_read(handler<size_t>&& h)
     _socket_impl->do_read(std::move(h));
 }
 
-std::vector<boost::asio::const_buffer>* socket::tx_buffers()
+void socket_base::do_write_all(handler<size_t>&& h)
+{
+    if (!_socket_impl) {
+        return h.post(asio::error::bad_descriptor, 0);
+    }
+
+    _socket_impl->do_write(std::move(h), true);
+}
+
+void socket_base::do_read_exactly(handler<size_t>&& h)
+{
+    if (!_socket_impl) {
+        return h.post(asio::error::bad_descriptor, 0);
+    }
+
+    _socket_impl->do_read(std::move(h), true);
+}
+
+void socket_base::do_send_message(handler<size_t>&& h)
+{
+    if (!_socket_impl) {
+        return h.post(asio::error::bad_descriptor, 0);
+    }
+
+    _socket_impl->do_send_message(std::move(h));
+}
+
+void socket_base::do_receive_message(handler<std::vector<unsigned char>>&& h)
+{
+    if (!_socket_impl) {
+        return h.post(asio::error::bad_descriptor, {});
+    }
+
+    _socket_impl->do_receive_message(std::move(h));
+}
+
+void socket_base::do_send_datagram(handler<size_t>&& h)
+{
+    if (!_socket_impl) {
+        return h.post(asio::error::bad_descriptor, 0);
+    }
+
+    _socket_impl->do_send_datagram(std::move(h));
+}
+
+void socket_base::do_receive_datagram(handler<size_t>&& h)
+{
+    if (!_socket_impl) {
+        return h.post(asio::error::bad_descriptor, 0);
+    }
+
+    _socket_impl->do_receive_datagram(std::move(h));
+}
+
+void socket_base::do_receive_chunks(handler<std::vector<chunk>>&& h)
+{
+    if (!_socket_impl) {
+        return h.post(asio::error::bad_descriptor, {});
+    }
+
+    _socket_impl->do_receive_chunks(std::move(h));
+}
+
+void socket_base::do_receive_provided(handler<provided_buffer>&& h)
+{
+    if (!_socket_impl) {
+        return h.post(asio::error::bad_descriptor, provided_buffer{0, 0});
+    }
+
+    _socket_impl->do_receive_provided(std::move(h));
+}
+
+void socket_base::do_provide_buffers( const std::vector<asio::mutable_buffer>& bufs
+                                    , sys::error_code& ec)
+{
+    if (!_socket_impl) {
+        ec = asio::error::bad_descriptor;
+        return;
+    }
+
+    for (auto& b : bufs) {
+        if (b.size() == 0) {
+            ec = asio::error::invalid_argument;
+            return;
+        }
+    }
+
+    _socket_impl->provide_buffers(bufs);
+}
+
+void socket_base::recycle_buffer(size_t index, sys::error_code& ec)
+{
+    if (!_socket_impl) {
+        ec = asio::error::bad_descriptor;
+        return;
+    }
+
+    if (!_socket_impl->recycle_buffer(index)) {
+        ec = asio::error::invalid_argument;
+    }
+}
+
+void socket_base::do_wait(wait_type w, handler<>&& h)
+{
+    if (!_socket_impl) {
+        return h.post(asio::error::bad_descriptor);
+    }
+
+    _socket_impl->do_wait(w, std::move(h));
+}
+
+size_t socket_base::do_read_some(sys::error_code& ec)
+{
+    assert(_socket_impl);
+    return _socket_impl->read_some(ec);
+}
+
+size_t socket_base::do_write_some(sys::error_code& ec)
+{
+    assert(_socket_impl);
+    return _socket_impl->write_some(ec);
+}
+
+size_t socket_base::available(sys::error_code& ec) const
+{
+    if (!_socket_impl) {
+        ec = asio::error::bad_descriptor;
+        return 0;
+    }
+
+    return _socket_impl->available();
+}
+
+void socket_base::on_data(std::function<on_data_handler> h)
+{
+    assert(_socket_impl);
+
+    if (h) {
+        _socket_impl->_data_handler
+            = make_shared<std::function<on_data_handler>>(move(h));
+    } else {
+        _socket_impl->_data_handler = nullptr;
+    }
+}
+
+detail::buffer_sequence<asio::const_buffer>* socket_base::tx_buffers()
 {
     if (!_socket_impl) return nullptr;
     return &_socket_impl->_tx_buffers;
 }
 
-std::vector<boost::asio::mutable_buffer>* socket::rx_buffers()
+detail::buffer_sequence<asio::mutable_buffer>* socket_base::rx_buffers()
 {
     if (!_socket_impl) return nullptr;
     return &_socket_impl->_rx_buffers;
 }
+
+detail::buffer_sequence<asio::const_buffer>* socket_base::datagram_tx_buffers()
+{
+    if (!_socket_impl) return nullptr;
+    return &_socket_impl->_tx_datagram_buffers;
+}
+
+detail::buffer_sequence<asio::mutable_buffer>* socket_base::datagram_rx_buffers()
+{
+    if (!_socket_impl) return nullptr;
+    return &_socket_impl->_rx_datagram_buffers;
+}
+
+detail::handler_memory* socket_base::tx_handler_memory()
+{
+    if (!_socket_impl) return nullptr;
+    return &_socket_impl->_tx_handler_memory;
+}
+
+detail::handler_memory* socket_base::rx_handler_memory()
+{
+    if (!_socket_impl) return nullptr;
+    return &_socket_impl->_rx_handler_memory;
+}
@@ -5,16 +5,19 @@
 #include "context.hpp"
 #include "util.hpp"
 #include "weak_from_this.hpp"
+#include "chunk_pool.hpp"
 
 #include <utp.h>
+#include <algorithm>
 
 using namespace std;
 using namespace asio_utp;
 
-socket_impl::socket_impl(socket* owner)
-    : _ex(owner->get_executor())
+socket_impl::socket_impl(detail::socket_base* owner)
+    : _ex(owner->_impl_ex)
     , _service(asio::use_service<service>(_ex.context()))
     , _owner(owner)
+    , _coalesce_timer(_ex)
 {
     static decltype(_debug_id) next_debug_id = 1;
     _debug_id = next_debug_id++;
@@ -40,7 +43,7 @@ void socket_impl::bind(const endpoint_type& ep, sys::error_code& ec)
     _context->register_socket(*this);
 }
 
-void socket_impl::bind(const udp_multiplexer& m)
+void socket_impl::bind(const detail::udp_multiplexer_base& m)
 {
     assert(!_context);
     _context = _service.maybe_create_context(m.impl());
@@ -54,7 +57,28 @@ void socket_impl::bind(const udp_multiplexer& m)
 
 void socket_impl::on_connect()
 {
-    post_op(_connect_handler, "connect", sys::error_code());
+    _established = true;
+
+    _context->path_metrics().add_rtt_sample
+        ( _remote_endpoint.address()
+        , chrono::duration_cast<chrono::microseconds>
+            (chrono::steady_clock::now() - _connect_started));
+
+    if (_server_first) {
+        // Lets the accepting side send, goes out before any other data.
+        static const unsigned char nudge = 0;
+        auto w = utp_write((utp_socket*) _utp_socket, (void*) &nudge, 1);
+        assert(w == 1);
+        (void) w;
+    }
+
+    if (_connect_handler) {
+        post_op(_connect_handler, "connect", sys::error_code());
+    }
+
+    // Writes issued before the connection was established (including the
+    // early data of `do_connect_with_data`) go out right away.
+    on_writable();
 }
 
 
@@ -67,42 +91,301 @@ void socket_impl::on_receive(const unsigned char* buf, size_t size)
     }
 
     using asio::const_buffer;
-    using asio::mutable_buffer;
-    using asio::buffer_cast;
-    using asio::buffer_size;
     using asio::buffer_copy;
 
+    // Libutp doesn't let an accepted socket send before it received some
+    // data, and doesn't tell us when that changes. Writes issued right after
+    // accept have been waiting, now they can go.
+    if (_awaiting_first_data) {
+        _awaiting_first_data = false;
+        if (_write_blocked) on_writable();
+    }
+
+    if (_drop_nudge) {
+        _drop_nudge = false;
+        ++buf;
+        if (--size == 0) return;
+    }
+
+    if (_recv_chunks_handler) {
+        assert(_rx_buffer_queue.empty());
+        std::vector<chunk> chunks;
+        chunks.push_back(make_chunk(buf, size));
+        post_op(_recv_chunks_handler, "recv", sys::error_code(), move(chunks));
+        return;
+    }
+
+    if (_recv_message_handler) {
+        _rx_buffer_queue.push_back(make_chunk(buf, size));
+        complete_message_read();
+        return;
+    }
+
+    if (!_recv_handler && !_provided_buffers.empty()) {
+        size_t n = 0;
+
+        // Queued data (waiting for a buffer to be recycled) goes first.
+        if (_rx_buffer_queue.empty()) {
+            n = fill_provided_buffers(buf, size);
+        }
+
+        if (n < size) {
+            _rx_buffer_queue.push_back(make_chunk(buf + n, size - n));
+        } else {
+            utp_read_drained((utp_socket*) _utp_socket);
+        }
+
+        complete_provided_read();
+        notify_readable();
+        return;
+    }
+
+    if (!_recv_handler && _data_handler) {
+        deliver_to_data_handler(buf, size);
+        if (!_rx_buffer_queue.empty()) notify_readable();
+        return;
+    }
+
     if (!_recv_handler) {
-        _rx_buffer_queue.push_back({buf, buf+size});
+        _rx_buffer_queue.push_back(make_chunk(buf, size));
+        notify_readable();
         return;
     }
 
     assert(_rx_buffer_queue.empty()); 
 
-    const_buffer src(buf, size);
+    size_t n = buffer_copy(_rx_buffers, const_buffer(buf, size));
+
+    // If the recv buffer is smaller than what we've received,
+    // we need to store it for later.
+    if (n < size) {
+        _rx_buffer_queue.push_back(make_chunk(buf + n, size - n));
+    } else {
+        utp_read_drained((utp_socket*) _utp_socket);
+    }
+
+    complete_read(n);
+}
+
+
+// Accounts for `n` bytes having been copied into `_rx_buffers` and posts the
+// read handler, unless it's an `async_read_exactly` with room left.
+void socket_impl::complete_read(size_t n)
+{
+    _rx_transferred += n;
+
+    if (_read_exactly) {
+        consume_rx_buffers(n);
+        if (asio::buffer_size(_rx_buffers) != 0) return;
+    }
+
+    size_t total = _rx_transferred;
+    _rx_transferred = 0;
+
+    post_op(_recv_handler, "recv", sys::error_code(), total);
+}
+
+
+void socket_impl::consume_rx_buffers(size_t n)
+{
+    for (auto& b : _rx_buffers) {
+        if (n == 0) break;
+        size_t c = std::min(n, b.size());
+        b += c;
+        n -= c;
+    }
+}
+
+
+void socket_impl::provide_buffers(const std::vector<asio::mutable_buffer>& bufs)
+{
+    for (auto& b : bufs) {
+        assert(b.size());
+        _provided_free.push_back(_provided_buffers.size());
+        _provided_buffers.push_back(b);
+    }
+
+    fill_provided_from_queue();
+    complete_provided_read();
+}
+
+
+bool socket_impl::recycle_buffer(size_t index)
+{
+    if (index >= _provided_buffers.size()) return false;
+
+    // Only a buffer the user holds can be given back.
+    if (_has_provided_filling && _provided_filling == index) return false;
+
+    if (find(_provided_free.begin(), _provided_free.end(), index)
+            != _provided_free.end()) {
+        return false;
+    }
+
+    for (auto& b : _provided_filled) {
+        if (b.index == index) return false;
+    }
+
+    _provided_free.push_back(index);
+
+    fill_provided_from_queue();
+    complete_provided_read();
+
+    return true;
+}
 
+
+// Copies as much as fits into the free provided buffers, returns the number
+// of bytes copied.
+size_t socket_impl::fill_provided_buffers(const unsigned char* data, size_t size)
+{
     size_t total = 0;
 
-    for (mutable_buffer dst : _rx_buffers) {
-        size_t c = buffer_copy(dst, src);
-        src = src + c;
+    while (size) {
+        if (!_has_provided_filling) {
+            if (_provided_free.empty()) break;
+            _provided_filling = _provided_free.front();
+            _provided_filling_size = 0;
+            _has_provided_filling = true;
+            _provided_free.pop_front();
+        }
+
+        auto dst = _provided_buffers[_provided_filling] + _provided_filling_size;
+
+        size_t c = asio::buffer_copy(dst, asio::buffer(data, size));
+
+        data  += c;
+        size  -= c;
         total += c;
 
-        // If the recv buffer is smaller than what we've received,
-        // we need to store it for later.
-        if (buffer_size(src) != 0) {
-            const unsigned char* begin = buffer_cast<const unsigned char*>(src);
-            const unsigned char* end   = begin + buffer_size(src);
-            _rx_buffer_queue.push_back({begin, end});
-            break;
+        _provided_filling_size += c;
+
+        if (_provided_filling_size == _provided_buffers[_provided_filling].size()) {
+            finish_provided_buffer();
+        }
+    }
+
+    return total;
+}
+
+
+// Moves data that arrived while no provided buffer was free into the ones
+// that are free now.
+void socket_impl::fill_provided_from_queue()
+{
+    if (_rx_buffer_queue.empty()) return;
+
+    while (!_rx_buffer_queue.empty()) {
+        auto& c = _rx_buffer_queue.front();
+        size_t n = fill_provided_buffers(c.data(), c.size());
+
+        if (n < c.size()) {
+            c.consume(n);
+            return;
         }
+
+        _rx_buffer_queue.pop_front();
     }
 
-    if (total == size) {
+    if (_utp_socket) {
         utp_read_drained((utp_socket*) _utp_socket);
     }
+}
 
-    post_op(_recv_handler, "recv", sys::error_code(), total);
+
+// Stops writing into the partially filled buffer and queues it for the
+// reader. Returns false if there was no such buffer.
+bool socket_impl::finish_provided_buffer()
+{
+    if (!_has_provided_filling || _provided_filling_size == 0) return false;
+    _provided_filled.push_back({_provided_filling, _provided_filling_size});
+    _has_provided_filling = false;
+    return true;
+}
+
+
+void socket_impl::complete_provided_read()
+{
+    if (!_recv_provided_handler) return;
+    if (_provided_filled.empty() && !finish_provided_buffer()) return;
+
+    auto f = _provided_filled.front();
+    _provided_filled.pop_front();
+
+    post_op(_recv_provided_handler, "recv", sys::error_code(), f);
+}
+
+
+// Data is handed over straight from libutp's buffer, only what the handler
+// didn't consume is copied into the queue.
+void socket_impl::deliver_to_data_handler(const unsigned char* buf, size_t size)
+{
+    // Whatever is queued goes first.
+    if (!offer_queued_data()) {
+        _rx_buffer_queue.push_back(make_chunk(buf, size));
+        return;
+    }
+
+    size_t n = invoke_data_handler(sys::error_code(), asio::buffer(buf, size));
+
+    if (n < size && !_closed) {
+        _rx_buffer_queue.push_back(make_chunk(buf + n, size - n));
+    }
+}
+
+
+chunk socket_impl::make_chunk(const unsigned char* data, size_t size)
+{
+    return _context->chunk_pool().make_chunk(data, size);
+}
+
+
+std::vector<chunk> socket_impl::take_queued_chunks()
+{
+    std::vector<chunk> chunks( make_move_iterator(_rx_buffer_queue.begin())
+                             , make_move_iterator(_rx_buffer_queue.end()));
+
+    _rx_buffer_queue.clear();
+
+    if (!chunks.empty() && _utp_socket) {
+        utp_read_drained((utp_socket*) _utp_socket);
+    }
+
+    return chunks;
+}
+
+
+// Returns true if the data handler consumed everything that was queued.
+bool socket_impl::offer_queued_data()
+{
+    if (_rx_buffer_queue.empty()) return true;
+
+    while (!_rx_buffer_queue.empty()) {
+        auto& buf = _rx_buffer_queue.front();
+        asio::const_buffer b = buf;
+
+        size_t n = invoke_data_handler(sys::error_code(), b);
+
+        if (_closed || !_data_handler) return false;
+
+        if (n < b.size()) {
+            buf.consume(n);
+            return false;
+        }
+
+        _rx_buffer_queue.pop_front();
+    }
+
+    utp_read_drained((utp_socket*) _utp_socket);
+    return true;
+}
+
+
+size_t socket_impl::invoke_data_handler( const sys::error_code& ec
+                                       , asio::const_buffer b)
+{
+    auto h = _data_handler;
+    return std::min((*h)(ec, b), b.size());
 }
 
 
@@ -118,16 +401,26 @@ void socket_impl::on_accept(void* usocket)
     utp_set_userdata((utp_socket*) usocket, this);
 
     _utp_socket = usocket;
+    _remote_endpoint = remote_endpoint();
+    _awaiting_first_data = true;
+    _drop_nudge = _server_first;
+    _established = true;
+    apply_utp_options();
     dispatch_op(_accept_handler, "accept", sys::error_code());
 }
 
 
+static void on_op_completed(const shared_ptr<void>& ctx, const char* dbg)
+{
+    static_cast<context*>(ctx.get())->decrement_completed_ops(dbg);
+}
+
 template<class Handler>
 void socket_impl::setup_op(Handler& target, Handler&& h, const char* dbg)
 {
     _context->increment_outstanding_ops(dbg);
     target = move(h);
-    target.exec_after([ctx = _context, dbg] { ctx->decrement_completed_ops(dbg); });
+    target.exec_after({&on_op_completed, _context, dbg});
 }
 
 template<class Handler, class... Args>
@@ -135,7 +428,7 @@ void socket_impl::post_op(Handler& h, const char* dbg, const sys::error_code& ec
 {
     _context->increment_completed_ops(dbg);
     _context->decrement_outstanding_ops(dbg);
-    h.post(ec, args...);
+    h.post(ec, std::move(args)...);
 }
 
 template<class Handler, class... Args>
@@ -143,10 +436,10 @@ void socket_impl::dispatch_op(Handler& h, const char* dbg, const sys::error_code
 {
     _context->increment_completed_ops(dbg);
     _context->decrement_outstanding_ops(dbg);
-    h.dispatch(ec, args...);
+    h.dispatch(ec, std::move(args)...);
 }
 
-void socket_impl::do_write(handler<size_t> h)
+void socket_impl::do_write(handler<size_t> h, bool write_all)
 {
     if (_debug) {
         log(this, " socket_impl::do_write");
@@ -160,33 +453,278 @@ void socket_impl::do_write(handler<size_t> h)
 
     setup_op(_send_handler, move(h), "write");
 
-    bool still_writable = true;
+    _write_all = write_all;
+
+    if (is_coalescing()) {
+        return write_coalesced();
+    }
+
+    write_tx_buffers();
+}
+
+
+// Hands as much of `_tx_buffers` over to libutp as it accepts, returns false
+// if it didn't take all of it. Consecutive buffers go in a single
+// `utp_writev` call so that libutp can put them in the same packet.
+bool socket_impl::write_to_libutp()
+{
+    static const size_t max_iovecs = 16;
+
+    auto i = _tx_buffers.begin();
+
+    while (true) {
+        // `utp_writev` modifies the vectors it's given.
+        utp_iovec iov[max_iovecs];
+        size_t iov_count = 0;
+        size_t requested = 0;
+
+        for (auto j = i; j != _tx_buffers.end() && iov_count < max_iovecs; ++j) {
+            if (j->size() == 0) continue;
+            iov[iov_count].iov_base = const_cast<void*>(j->data());
+            iov[iov_count].iov_len  = j->size();
+            requested += j->size();
+            ++iov_count;
+        }
+
+        if (requested == 0) return true;
+
+        auto w = utp_writev((utp_socket*) _utp_socket, iov, iov_count);
+
+        assert(w >= 0);
+
+        _bytes_sent += w;
+
+        for (size_t n = w; n && i != _tx_buffers.end(); ++i) {
+            size_t c = std::min(n, i->size());
+            *i += c;
+            n -= c;
+            if (i->size()) break;
+        }
+
+        if (size_t(w) < requested) {
+            _write_blocked = true;
+            return false;
+        }
+    }
+}
+
+
+void socket_impl::write_tx_buffers()
+{
+    if (write_to_libutp()) {
+        complete_write(sys::error_code());
+    }
+}
+
+
+void socket_impl::complete_write(const sys::error_code& ec)
+{
+    size_t n = _bytes_sent - std::min(_bytes_sent, _tx_overhead);
+
+    _bytes_sent = 0;
+    _tx_overhead = 0;
+
+    post_op(_send_handler, "write", ec, n);
+}
+
+
+// Enough for a few full size packets. Libutp splits each flush into packets
+// of its current MTU, so only the tail of a flush may go out undersized.
+static const size_t coalesce_buffer_size = 8 * 1024;
+
+bool socket_impl::is_coalescing() const
+{
+    return _cork || _coalesce_delay.count() > 0;
+}
+
+
+// Appends as much of `_tx_buffers` to `_coalesce_buffer` as fits, handing
+// full buffers over to libutp. Returns the number of bytes accepted.
+size_t socket_impl::coalesce_tx_buffers()
+{
+    size_t accepted = 0;
+    bool full = false;
 
     for (auto& b : _tx_buffers) {
         while (size_t s = asio::buffer_size(b)) {
-            // TODO: Use utp_writev
-            auto w = utp_write( (utp_socket*) _utp_socket
-                              , (void*) asio::buffer_cast<const void*>(b)
-                              , s);
+            if (_coalesce_buffer.size() == coalesce_buffer_size) {
+                if (!flush_coalesced()) {
+                    full = true;
+                    break;
+                }
+            }
 
-            assert(w >= 0);
+            size_t n = std::min(s, coalesce_buffer_size - _coalesce_buffer.size());
+            auto p = asio::buffer_cast<const unsigned char*>(b);
 
-            _bytes_sent += w;
-            b = b + w;
-            s = asio::buffer_size(b);
+            _coalesce_buffer.insert(_coalesce_buffer.end(), p, p + n);
 
-            if (size_t(w) < s) {
-                still_writable = false;
-                break;
-            }
+            b = b + n;
+            accepted += n;
         }
 
-        if (!still_writable) break;
+        if (full) break;
     }
 
-    if (still_writable) {
-        post_op(_send_handler, "write", sys::error_code(), _bytes_sent);
-        _bytes_sent = 0;
+    if (_coalesce_buffer.size() == coalesce_buffer_size) {
+        flush_coalesced();
+    }
+
+    start_coalesce_timer();
+
+    return accepted;
+}
+
+
+// The write completes as soon as some bytes have been accepted (or all of
+// them with `_write_all`), otherwise it waits for `on_writable`.
+void socket_impl::write_coalesced()
+{
+    _bytes_sent += coalesce_tx_buffers();
+
+    if (asio::buffer_size(_tx_buffers) != 0
+            && (_write_all || _bytes_sent == 0)) {
+        return;
+    }
+
+    complete_write(sys::error_code());
+}
+
+
+// Returns false if libutp didn't accept all the coalesced bytes, the rest
+// is then retried from `on_writable`.
+bool socket_impl::flush_coalesced()
+{
+    if (!_utp_socket) return _coalesce_buffer.empty();
+
+    while (_coalesce_flushed < _coalesce_buffer.size()) {
+        auto w = utp_write( (utp_socket*) _utp_socket
+                          , _coalesce_buffer.data() + _coalesce_flushed
+                          , _coalesce_buffer.size() - _coalesce_flushed);
+
+        assert(w >= 0);
+
+        if (w <= 0) {
+            _write_blocked = true;
+            return false;
+        }
+
+        _coalesce_flushed += w;
+    }
+
+    _coalesce_buffer.clear();
+    _coalesce_flushed = 0;
+
+    return true;
+}
+
+
+void socket_impl::start_coalesce_timer()
+{
+    if (_coalesce_timer_armed) return;
+    if (_coalesce_buffer.empty()) return;
+    if (_coalesce_delay.count() == 0) return;
+
+    _coalesce_timer_armed = true;
+    _coalesce_timer.expires_after(_coalesce_delay);
+    _coalesce_timer.async_wait(
+        [this, wself = asio_utp::weak_from_this(this)]
+        (const sys::error_code& ec) {
+            auto self = wself.lock();
+            if (!self) return;
+            _coalesce_timer_armed = false;
+            if (ec || _closed) return;
+            flush_coalesced();
+        });
+}
+
+
+void socket_impl::set_cork(bool value)
+{
+    _cork = value;
+    if (!is_coalescing()) flush_coalesced();
+}
+
+
+void socket_impl::set_utp_option(int opt, int value)
+{
+    _utp_options[opt] = value;
+
+    if (_utp_socket) {
+        utp_setsockopt( (utp_socket*) _utp_socket
+                      , opt
+                      , utp_option_value(opt, value));
+    }
+}
+
+// Before there is a libutp socket, what it's going to get.
+int socket_impl::get_utp_option(int opt) const
+{
+    if (_utp_socket) {
+        return utp_getsockopt((utp_socket*) _utp_socket, opt);
+    }
+
+    auto i = _utp_options.find(opt);
+
+    if (i != _utp_options.end()) {
+        return utp_option_value(opt, i->second);
+    }
+
+    return utp_option_value(opt,
+            utp_context_get_option(_context->get_libutp_context(), opt));
+}
+
+void socket_impl::apply_utp_options()
+{
+    assert(_utp_socket);
+
+    for (auto& o : _utp_options) {
+        utp_setsockopt( (utp_socket*) _utp_socket
+                      , o.first
+                      , utp_option_value(o.first, o.second));
+    }
+
+    if (_congestion_control != congestion_controller::ledbat) {
+        set_congestion_control(_congestion_control);
+    }
+}
+
+// What libutp gets for `opt` when the user asked for `value`.
+int socket_impl::utp_option_value(int opt, int value) const
+{
+    if (opt == UTP_TARGET_DELAY
+            && _congestion_control == congestion_controller::ledbat_large_target) {
+        return large_target_delay;
+    }
+
+    return value;
+}
+
+void socket_impl::set_congestion_control(congestion_controller c)
+{
+    _congestion_control = c;
+
+    if (!_utp_socket) return;
+
+    auto i = _utp_options.find(UTP_TARGET_DELAY);
+
+    int v = i != _utp_options.end()
+          ? i->second
+          : utp_context_get_option(_context->get_libutp_context(), UTP_TARGET_DELAY);
+
+    utp_setsockopt( (utp_socket*) _utp_socket
+                  , UTP_TARGET_DELAY
+                  , utp_option_value(UTP_TARGET_DELAY, v));
+}
+
+void socket_impl::set_coalesce_delay(std::chrono::milliseconds delay)
+{
+    _coalesce_delay = delay;
+
+    if (!is_coalescing()) {
+        flush_coalesced();
+    } else {
+        start_coalesce_timer();
     }
 }
 
@@ -197,11 +735,125 @@ void socket_impl::on_writable()
         log(this, " socket_impl::on_writable");
     }
 
-    if (!_send_handler) return;
-    do_write(move(_send_handler));
+    _write_blocked = false;
+
+    if (!flush_coalesced()) return;
+
+    if (_send_handler) {
+        if (is_coalescing()) {
+            write_coalesced();
+        } else {
+            write_tx_buffers();
+        }
+    }
+
+    notify_writable();
 }
 
-void socket_impl::do_read(handler<size_t> h)
+bool socket_impl::is_writable() const
+{
+    return _utp_socket && !_write_blocked && !_send_handler;
+}
+
+void socket_impl::notify_readable()
+{
+    if (!_wait_read_handler) return;
+    post_op(_wait_read_handler, "wait", sys::error_code());
+}
+
+void socket_impl::notify_writable()
+{
+    if (!_wait_write_handler) return;
+    if (!is_writable()) return;
+    post_op(_wait_write_handler, "wait", sys::error_code());
+}
+
+void socket_impl::do_wait(asio::socket_base::wait_type w, handler<> h)
+{
+    if (_debug) {
+        log(this, " debug_id:", _debug_id, " socket_impl::do_wait ", int(w));
+    }
+
+    if (!is_open()) {
+        return h.post(asio::error::bad_descriptor);
+    }
+
+    switch (w) {
+        case asio::socket_base::wait_read:
+            assert(!_wait_read_handler);
+            setup_op(_wait_read_handler, move(h), "wait");
+            if (!_rx_buffer_queue.empty() || !_provided_filled.empty()
+                    || (_has_provided_filling && _provided_filling_size)
+                    || _got_eof) {
+                notify_readable();
+            }
+            return;
+
+        case asio::socket_base::wait_write:
+            assert(!_wait_write_handler);
+            setup_op(_wait_write_handler, move(h), "wait");
+            notify_writable();
+            return;
+
+        default:
+            return h.post(asio::error::operation_not_supported);
+    }
+}
+
+size_t socket_impl::read_some(sys::error_code& ec)
+{
+    assert(!_recv_handler);
+
+    if (!is_open()) {
+        ec = asio::error::bad_descriptor;
+        return 0;
+    }
+
+    if (asio::buffer_size(_rx_buffers) == 0) {
+        return 0;
+    }
+
+    if (_rx_buffer_queue.empty()) {
+        ec = _got_eof ? asio::error::connection_reset
+                      : asio::error::would_block;
+        return 0;
+    }
+
+    return read_from_queue();
+}
+
+size_t socket_impl::write_some(sys::error_code& ec)
+{
+    assert(!_send_handler);
+
+    if (!_utp_socket || _closed) {
+        ec = asio::error::bad_descriptor;
+        return 0;
+    }
+
+    size_t n = 0;
+
+    if (is_coalescing()) {
+        n = coalesce_tx_buffers();
+    } else {
+        write_to_libutp();
+        n = _bytes_sent;
+        _bytes_sent = 0;
+    }
+
+    if (n == 0 && asio::buffer_size(_tx_buffers) != 0) {
+        ec = asio::error::would_block;
+    }
+
+    return n;
+}
+
+size_t socket_impl::available() const
+{
+    return asio::buffer_size(_rx_buffer_queue);
+}
+
+void socket_impl::do_read(handler<size_t> h, bool read_exactly)
 {
     if (_debug) {
         log(this, " debug_id:", _debug_id, " socket_impl::do_read ",
@@ -217,12 +869,27 @@ void socket_impl::do_read(handler<size_t> h)
         return h.post(asio::error::bad_descriptor, 0);
     }
 
-    if (asio::buffer_size(_rx_buffers) == 0) {
+    size_t requested = asio::buffer_size(_rx_buffers);
+
+    if (requested == 0) {
         return h.post(sys::error_code(), 0);
     }
 
+    // Data is already here, so there is no need to involve the context and
+    // its operation counters.
+    if (_immediate_completion && !_rx_buffer_queue.empty()
+            && (!read_exactly || available() >= requested)
+            && complete_inline()) {
+        return h.dispatch(sys::error_code(), read_from_queue());
+    }
+
+    _inline_completions = 0;
+
     setup_op(_recv_handler, move(h), "read");
 
+    _read_exactly = read_exactly;
+    _rx_transferred = 0;
+
     // If we haven't yet received anything, we wait. But note that if we did,
     // but the _rx_buffers is empty, then we still post the callback with zero
     // size.
@@ -233,24 +900,309 @@ void socket_impl::do_read(handler<size_t> h)
         return;
     }
 
+    complete_read(read_from_queue());
+
+    if (_recv_handler && _got_eof) {
+        close_with_error(asio::error::connection_reset);
+    }
+}
+
+
+// Moves as much of the queued data as fits into `_rx_buffers`.
+size_t socket_impl::read_from_queue()
+{
     size_t s = asio::buffer_copy(_rx_buffers, _rx_buffer_queue);
-    size_t r = s;
+    consume_queue(s);
+    return s;
+}
+
+
+void socket_impl::consume_queue(size_t n)
+{
+    if (n == 0) return;
 
-    while (r) {
+    while (n) {
         assert(!_rx_buffer_queue.empty());
 
         auto& buf = _rx_buffer_queue.front();
 
-        if (r >= buf.size() - buf.consumed) {
-            r -= buf.size() - buf.consumed;
-            _rx_buffer_queue.erase(_rx_buffer_queue.begin());
+        if (n >= buf.size()) {
+            n -= buf.size();
+            _rx_buffer_queue.pop_front();
         } else {
-            buf.consumed += r;
+            buf.consume(n);
             break;
         }
     }
 
-    post_op(_recv_handler, "recv", sys::error_code(), s);
+    if (_rx_buffer_queue.empty() && _utp_socket) {
+        // Let the other end know the receive window opened up again.
+        utp_read_drained((utp_socket*) _utp_socket);
+    }
+}
+
+
+void socket_impl::do_send_message(handler<size_t> h)
+{
+    assert(!_send_handler);
+
+    if (!_utp_socket) {
+        return h.post(asio::error::bad_descriptor, 0);
+    }
+
+    // The first buffer is reserved for the length prefix.
+    assert(_tx_buffers.size() && _tx_buffers.begin()->size() == 0);
+
+    size_t size = asio::buffer_size(_tx_buffers);
+
+    if (size > 0xffffffff) {
+        return h.post(asio::error::message_size, 0);
+    }
+
+    _tx_message_header[0] = (size >> 24) & 0xff;
+    _tx_message_header[1] = (size >> 16) & 0xff;
+    _tx_message_header[2] = (size >>  8) & 0xff;
+    _tx_message_header[3] = (size >>  0) & 0xff;
+
+    *_tx_buffers.begin() = asio::buffer(_tx_message_header);
+    _tx_overhead = sizeof(_tx_message_header);
+
+    do_write(move(h), true);
+}
+
+
+void socket_impl::do_receive_message(handler<std::vector<unsigned char>> h)
+{
+    if (_debug) {
+        log(this, " debug_id:", _debug_id, " socket_impl::do_receive_message ",
+            " buffer_size(_rx_buffer_queue):", asio::buffer_size(_rx_buffer_queue));
+    }
+
+    assert(!_recv_handler);
+    assert(!_recv_message_handler);
+
+    if (!is_open()) {
+        return h.post(asio::error::bad_descriptor, {});
+    }
+
+    setup_op(_recv_message_handler, move(h), "recv");
+
+    complete_message_read();
+
+    if (_recv_message_handler && _got_eof) {
+        close_with_error(asio::error::connection_reset);
+    }
+}
+
+
+void socket_impl::do_send_datagram(handler<size_t> h)
+{
+    if (!_utp_socket || _closed) {
+        return h.post(asio::error::bad_descriptor, 0);
+    }
+
+    // The first buffer is reserved for the header.
+    assert(_tx_datagram_buffers.size()
+            && _tx_datagram_buffers.begin()->size() == 0);
+
+    size_t size = asio::buffer_size(_tx_datagram_buffers);
+
+    if (size > detail::socket_base::max_datagram_size) {
+        return h.post(asio::error::message_size, 0);
+    }
+
+    // Libutp keeps us blocked for as long as its congestion window is full,
+    // datagrams don't get to jump ahead of it.
+    if (_write_blocked) {
+        return h.post(asio::error::no_buffer_space, 0);
+    }
+
+    *_tx_datagram_buffers.begin() = asio::buffer(&context::datagram_marker, 1);
+
+    sys::error_code ec;
+    _context->_multiplexer->send_to(_tx_datagram_buffers, _remote_endpoint, 0, ec);
+
+    h.post(ec, ec ? 0 : size);
+}
+
+
+void socket_impl::do_receive_datagram(handler<size_t> h)
+{
+    assert(!_recv_datagram_handler);
+
+    if (!is_open()) {
+        return h.post(asio::error::bad_descriptor, 0);
+    }
+
+    if (!_rx_datagrams.empty()) {
+        size_t n = asio::buffer_copy( _rx_datagram_buffers
+                                    , asio::const_buffer(_rx_datagrams.front()));
+        _rx_datagrams.pop_front();
+        return h.post(sys::error_code(), n);
+    }
+
+    setup_op(_recv_datagram_handler, move(h), "recv_datagram");
+}
+
+
+// Called by the context with the payload of a datagram from our peer. If a
+// receive is pending the data goes straight from the UDP receive buffer into
+// the user's buffers.
+void socket_impl::on_datagram(const unsigned char* data, size_t size)
+{
+    if (_recv_datagram_handler) {
+        size_t n = asio::buffer_copy( _rx_datagram_buffers
+                                    , asio::const_buffer(data, size));
+        return post_op(_recv_datagram_handler, "recv_datagram", sys::error_code(), n);
+    }
+
+    if (_rx_datagrams.size() == max_queued_datagrams) {
+        _rx_datagrams.pop_front();
+    }
+
+    _rx_datagrams.push_back(make_chunk(data, size));
+}
+
+
+// Moves queued data into `_rx_message`, returns true once it holds a whole
+// message. Data is taken out of the queue as soon as possible so that
+// messages bigger than the receive window can be received.
+bool socket_impl::assemble_message()
+{
+    if (!_rx_message_header_done) {
+        unsigned char h[4];
+
+        if (asio::buffer_size(_rx_buffer_queue) < sizeof(h)) return false;
+
+        asio::buffer_copy(asio::buffer(h), _rx_buffer_queue);
+        consume_queue(sizeof(h));
+
+        _rx_message_size = (size_t(h[0]) << 24)
+                         | (size_t(h[1]) << 16)
+                         | (size_t(h[2]) <<  8)
+                         | (size_t(h[3]) <<  0);
+
+        _rx_message_header_done = true;
+        _rx_message.clear();
+
+        if (_rx_message_size > _max_message_size) return true;
+
+        _rx_message.reserve(_rx_message_size);
+    }
+
+    size_t taken = 0;
+
+    for (auto& c : _rx_buffer_queue) {
+        size_t n = std::min(c.size(), _rx_message_size - _rx_message.size());
+        _rx_message.insert(_rx_message.end(), c.data(), c.data() + n);
+        taken += n;
+        if (_rx_message.size() == _rx_message_size) break;
+    }
+
+    consume_queue(taken);
+
+    return _rx_message.size() == _rx_message_size;
+}
+
+
+void socket_impl::complete_message_read()
+{
+    assert(_recv_message_handler);
+
+    if (!assemble_message()) return;
+
+    _rx_message_header_done = false;
+
+    if (_rx_message_size > _max_message_size) {
+        // We can't tell where the next message starts.
+        return close_with_error(asio::error::message_size);
+    }
+
+    auto msg = move(_rx_message);
+    _rx_message = {};
+
+    post_op(_recv_message_handler, "recv", sys::error_code(), move(msg));
+}
+
+
+// With `immediate_completion`, reads of data already queued complete right
+// away. A handler starting the next read from within nests one stack frame
+// deeper each time, so after `max_inline_completions` such reads in a row
+// the next one goes the posted way (which resets the count).
+bool socket_impl::complete_inline()
+{
+    return _inline_completions++ < max_inline_completions;
+}
+
+
+void socket_impl::do_receive_chunks(handler<std::vector<chunk>> h)
+{
+    if (_debug) {
+        log(this, " debug_id:", _debug_id, " socket_impl::do_receive_chunks ",
+            " _rx_buffer_queue.size():", _rx_buffer_queue.size());
+    }
+
+    assert(!_recv_handler);
+    assert(!_recv_chunks_handler);
+
+    if (!is_open()) {
+        return h.post(asio::error::bad_descriptor, {});
+    }
+
+    if (_immediate_completion && !_rx_buffer_queue.empty() && complete_inline()) {
+        return h.dispatch(sys::error_code(), take_queued_chunks());
+    }
+
+    _inline_completions = 0;
+
+    setup_op(_recv_chunks_handler, move(h), "recv");
+
+    if (_rx_buffer_queue.empty()) {
+        if (_got_eof) {
+            close_with_error(asio::error::connection_reset);
+        }
+        return;
+    }
+
+    post_op(_recv_chunks_handler, "recv", sys::error_code(), take_queued_chunks());
+}
+
+
+void socket_impl::do_receive_provided(handler<provided_buffer> h)
+{
+    if (_debug) {
+        log(this, " debug_id:", _debug_id, " socket_impl::do_receive_provided ",
+            " _provided_filled.size():", _provided_filled.size());
+    }
+
+    assert(!_recv_handler);
+    assert(!_recv_provided_handler);
+
+    if (!is_open()) {
+        return h.post(asio::error::bad_descriptor, provided_buffer{0, 0});
+    }
+
+    if (_provided_buffers.empty()) {
+        return h.post(asio::error::invalid_argument, provided_buffer{0, 0});
+    }
+
+    if (_immediate_completion
+            && (!_provided_filled.empty() || finish_provided_buffer())
+            && complete_inline()) {
+        auto f = _provided_filled.front();
+        _provided_filled.pop_front();
+        return h.dispatch(sys::error_code(), f);
+    }
+
+    _inline_completions = 0;
+
+    setup_op(_recv_provided_handler, move(h), "recv");
+
+    complete_provided_read();
+
+    if (_recv_provided_handler && _got_eof && _rx_buffer_queue.empty()) {
+        close_with_error(asio::error::connection_reset);
+    }
 }
 
 
@@ -291,6 +1243,9 @@ void socket_impl::close()
         log(this, " socket_impl::close()");
     }
 
+    // Hand over what we can, libutp delivers it before sending the FIN.
+    flush_coalesced();
+
     close_with_error(asio::error::operation_aborted);
 }
 
@@ -307,8 +1262,18 @@ void socket_impl::on_eof()
     _got_eof = true;
 
     if (_recv_handler) {
-        post_op(_recv_handler, "recv", asio::error::connection_reset, 0);
+        post_op(_recv_handler, "recv", asio::error::connection_reset, _rx_transferred);
+    } else if (_recv_chunks_handler) {
+        post_op(_recv_chunks_handler, "recv", asio::error::connection_reset, vector<chunk>());
+    } else if (_recv_message_handler) {
+        post_op(_recv_message_handler, "recv", asio::error::connection_reset, vector<unsigned char>());
+    } else if (_recv_provided_handler && _rx_buffer_queue.empty()) {
+        post_op(_recv_provided_handler, "recv", asio::error::connection_reset, provided_buffer{0, 0});
+    } else if (_data_handler && _rx_buffer_queue.empty()) {
+        invoke_data_handler(asio::error::connection_reset, asio::const_buffer());
     }
+
+    notify_readable();
 }
 
 
@@ -352,12 +1317,20 @@ void socket_impl::close_with_error(const sys::error_code& ec)
         assert(!_accept_handler);
         assert(!_connect_handler);
         assert(!_recv_handler);
+        assert(!_recv_chunks_handler);
+        assert(!_recv_provided_handler);
+        assert(!_recv_message_handler);
+        assert(!_recv_datagram_handler);
         assert(!_send_handler);
+        assert(!_wait_read_handler);
+        assert(!_wait_write_handler);
         return;
     }
 
     _closed = true;
 
+    _coalesce_timer.cancel();
+
     if (_accept_handler) {
         post_op(_accept_handler, "accept", ec);
     }
@@ -367,16 +1340,42 @@ void socket_impl::close_with_error(const sys::error_code& ec)
     }
 
     if (_recv_handler) {
-        post_op(_recv_handler, "recv", ec, 0);
+        post_op(_recv_handler, "recv", ec, _rx_transferred);
+    }
+
+    if (_recv_chunks_handler) {
+        post_op(_recv_chunks_handler, "recv", ec, vector<chunk>());
+    }
+
+    if (_recv_provided_handler) {
+        post_op(_recv_provided_handler, "recv", ec, provided_buffer{0, 0});
+    }
+
+    if (_recv_message_handler) {
+        post_op(_recv_message_handler, "recv", ec, vector<unsigned char>());
+    }
+
+    if (_recv_datagram_handler) {
+        post_op(_recv_datagram_handler, "recv_datagram", ec, 0);
     }
 
     if (_send_handler) {
-        post_op(_send_handler, "send", ec, 0);
+        complete_write(ec);
+    }
+
+    if (_wait_read_handler) {
+        post_op(_wait_read_handler, "wait", ec);
+    }
+
+    if (_wait_write_handler) {
+        post_op(_wait_write_handler, "wait", ec);
     }
 
     auto s = (utp_socket*) _utp_socket;
 
     if (s) {
+        if (_established) record_path_metrics();
+
         // Note: Calling utp_close may trigger a call to this function again.
         utp_close(s);
         _self = shared_from_this();
@@ -389,6 +1388,24 @@ void socket_impl::close_with_error(const sys::error_code& ec)
 }
 
 
+// Leaves what libutp learned about the path to the context's cache.
+void socket_impl::record_path_metrics()
+{
+    auto s = (utp_socket*) _utp_socket;
+    assert(s);
+
+    uint32 ours = 0, theirs = 0, age = 0;
+    utp_get_delays(s, &ours, &theirs, &age);
+
+    auto stats = utp_get_stats(s);
+
+    _context->path_metrics().add_close_sample
+        ( _remote_endpoint.address()
+        , chrono::microseconds(ours)
+        , stats ? stats->mtu_guess : 0);
+}
+
+
 socket_impl::~socket_impl()
 {
     if (_debug) {
@@ -417,10 +1434,46 @@ void socket_impl::do_connect(const endpoint_type& ep, handler<> h)
 
     setup_op(_connect_handler, move(h), "connect");
 
+    start_connect(ep);
+}
+
+
+// Connects and writes `_tx_buffers` in one operation. The data is handed
+// over to libutp from within the callback reporting the connection, so it
+// leaves together with the end of the handshake instead of waiting for the
+// connect handler to run and issue a write. The handler completes once all
+// of it has been accepted by libutp.
+void socket_impl::do_connect_with_data(const endpoint_type& ep, handler<size_t> h)
+{
+    if (_debug) {
+        log(this, " debug_id:", _debug_id, " socket_impl::do_connect_with_data ep:", ep
+                , " size:", asio::buffer_size(_tx_buffers));
+    }
+
+    assert(!_utp_socket);
+    assert(!_send_handler);
+
+    setup_op(_send_handler, move(h), "write");
+    _write_all = true;
+
+    start_connect(ep);
+}
+
+
+void socket_impl::start_connect(const endpoint_type& ep)
+{
+    _connect_started = chrono::steady_clock::now();
+
     sockaddr_storage addr = util::to_sockaddr(ep);
 
+    // Not writable until libutp reports UTP_STATE_CONNECT.
+    _write_blocked = true;
+
+    _remote_endpoint = ep;
+
     _utp_socket = utp_create_socket(_context->get_libutp_context());
     utp_set_userdata((utp_socket*) _utp_socket, this);
+    apply_utp_options();
 
     utp_connect((utp_socket*) _utp_socket, (sockaddr*) &addr, util::sockaddr_size(addr));
 }
@@ -1,15 +1,23 @@
 #pragma once
 
 #include <boost/intrusive/list.hpp>
+#include <boost/asio/steady_timer.hpp>
 #include <asio_utp/detail/handler.hpp>
+#include <asio_utp/chunk.hpp>
+#include <asio_utp/socket.hpp>
 #include "intrusive_list.hpp"
+#include <deque>
+#include <map>
 
 namespace asio_utp {
     
 class context;
-class socket;
 class service;
-class udp_multiplexer;
+
+namespace detail {
+    class socket_base;
+    class udp_multiplexer_base;
+}
 
 class socket_impl : public std::enable_shared_from_this<socket_impl> {
 public:
@@ -22,10 +30,10 @@ public:
     socket_impl(socket_impl&&) = delete;
     socket_impl& operator=(socket_impl&&) = delete;
 
-    socket_impl(socket*);
+    socket_impl(detail::socket_base*);
 
     void bind(const endpoint_type&, sys::error_code&);
-    void bind(const udp_multiplexer&);
+    void bind(const detail::udp_multiplexer_base&);
 
     endpoint_type local_endpoint() const;
     endpoint_type remote_endpoint() const;
@@ -43,24 +51,83 @@ public:
 
 private:
     friend class ::asio_utp::context;
-    friend class ::asio_utp::socket;
+    friend class ::asio_utp::detail::socket_base;
+    friend struct ::asio_utp::detail::connect_any_state;
 
     void on_connect();
     void on_writable();
+    bool complete_inline();
     void on_eof();
     void on_destroy();
     void on_accept(void* usocket);
     void on_receive(const unsigned char*, size_t);
+    void on_datagram(const unsigned char*, size_t);
+
+    chunk make_chunk(const unsigned char*, size_t);
+    std::vector<chunk> take_queued_chunks();
+
+    void provide_buffers(const std::vector<boost::asio::mutable_buffer>&);
+    bool recycle_buffer(size_t index);
+    size_t fill_provided_buffers(const unsigned char*, size_t);
+    void fill_provided_from_queue();
+    bool finish_provided_buffer();
+    void complete_provided_read();
+
+    void deliver_to_data_handler(const unsigned char*, size_t);
+    bool offer_queued_data();
+    size_t invoke_data_handler(const sys::error_code&, boost::asio::const_buffer);
 
     intrusive::list_hook _register_hook;
     intrusive::list_hook _accept_hook;
 
-    void do_write(handler<size_t>);
-    void do_read(handler<size_t>);
+    void do_write(handler<size_t>, bool write_all = false);
+    void do_read(handler<size_t>, bool read_exactly = false);
     void do_connect(const endpoint_type&, handler<>);
+    void do_connect_with_data(const endpoint_type&, handler<size_t>);
+    void start_connect(const endpoint_type&);
     void do_accept(handler<>);
+    void do_wait(boost::asio::socket_base::wait_type, handler<>);
+    void do_receive_chunks(handler<std::vector<chunk>>);
+    void do_receive_provided(handler<provided_buffer>);
+    void do_send_message(handler<size_t>);
+    void do_receive_message(handler<std::vector<unsigned char>>);
+    void do_send_datagram(handler<size_t>);
+    void do_receive_datagram(handler<size_t>);
+
+    size_t read_some(sys::error_code&);
+    size_t write_some(sys::error_code&);
+    size_t available() const;
+
+    bool write_to_libutp();
+    void write_tx_buffers();
+    void complete_write(const sys::error_code&);
+    size_t read_from_queue();
+    void consume_queue(size_t);
+    bool assemble_message();
+    void complete_message_read();
+    void complete_read(size_t);
+    void consume_rx_buffers(size_t);
+
+    bool is_writable() const;
+    void notify_readable();
+    void notify_writable();
+
+    bool is_coalescing() const;
+    size_t coalesce_tx_buffers();
+    void write_coalesced();
+    bool flush_coalesced();
+    void start_coalesce_timer();
+    void set_cork(bool);
+    void set_coalesce_delay(std::chrono::milliseconds);
+
+    void set_utp_option(int opt, int value);
+    int get_utp_option(int opt) const;
+    void apply_utp_options();
+    int utp_option_value(int opt, int value) const;
+    void set_congestion_control(congestion_controller);
 
     void close_with_error(const boost::system::error_code&);
+    void record_path_metrics();
 
     bool is_active() const;
 
@@ -78,37 +145,125 @@ private:
     service& _service;
 
     void* _utp_socket = nullptr;
-    socket* _owner = nullptr;
+    detail::socket_base* _owner = nullptr;
     bool _closed = false;
     bool _got_eof = false;
 
     std::shared_ptr<context> _context;
 
+    // Must outlive the handlers below.
+    detail::handler_memory _tx_handler_memory;
+    detail::handler_memory _rx_handler_memory;
+
     handler<> _connect_handler;
     handler<> _accept_handler;
     handler<size_t> _send_handler;
     handler<size_t> _recv_handler;
+    handler<std::vector<chunk>> _recv_chunks_handler;
+    handler<provided_buffer> _recv_provided_handler;
+    handler<std::vector<unsigned char>> _recv_message_handler;
+    handler<size_t> _recv_datagram_handler;
+    handler<> _wait_read_handler;
+    handler<> _wait_write_handler;
 
-    size_t _bytes_sent = 0;
-    std::vector<boost::asio::const_buffer> _tx_buffers;
+    // Set when libutp didn't take everything we tried to write, cleared once
+    // it tells us the socket is writable again.
+    bool _write_blocked = false;
+
+    // Set on accepted sockets until the first data arrives (see README).
+    bool _awaiting_first_data = false;
 
-    struct buf_t : public std::vector<unsigned char> {
-        using std::vector<unsigned char>::vector;
+    // See `asio_utp::server_first`. `_drop_nudge` is set on accepted sockets
+    // until the byte sent by the connecting side has been dropped.
+    bool _server_first = false;
+    bool _drop_nudge = false;
 
-        size_t consumed = 0;
+    // Libutp socket options (`UTP_TARGET_DELAY`, ...) set by the user, kept
+    // to be applied once `_utp_socket` exists.
+    std::map<int, int> _utp_options;
 
-        operator boost::asio::const_buffer() const {
-            assert(consumed <= this->size());
-            return boost::asio::const_buffer( this->data() + consumed
-                                            , this->size() - consumed);
-        }
-    };
+    // See `asio_utp::congestion_control`, `ledbat_large_target` overrides
+    // the target delay in `_utp_options` with this one (in microseconds).
+    congestion_controller _congestion_control = congestion_controller::ledbat;
+    static const int large_target_delay = 5 * 1000 * 1000;
+
+    // See `asio_utp::forward_error_correction`, used by the context when
+    // libutp sends packets for this socket.
+    size_t _fec_group_size = 0;
+
+    // For the handshake RTT sample fed to the context's `path_metrics`.
+    std::chrono::steady_clock::time_point _connect_started;
+
+    // Set once connected or accepted, only then is the path worth recording.
+    bool _established = false;
+
+    // Set for `async_write_all`, which only completes once all of
+    // `_tx_buffers` has been handed over to libutp (or coalesced).
+    bool _write_all = false;
+
+    size_t _bytes_sent = 0;
 
-    // TODO: std::queue is not iterable (required by BufferSequences).
-    // Perhaps use something like this?
-    // https://stackoverflow.com/a/5984198/273348
-    std::vector<buf_t> _rx_buffer_queue;
-    std::vector<boost::asio::mutable_buffer> _rx_buffers;
+    // Bytes at the front of `_tx_buffers` added by the library (the length
+    // prefix of a message) which are not reported to the write handler.
+    size_t _tx_overhead = 0;
+    unsigned char _tx_message_header[4];
+    detail::buffer_sequence<boost::asio::const_buffer> _tx_buffers;
+
+    // Write coalescing (see `asio_utp::cork` and `asio_utp::coalesce_delay`).
+    // Bytes in `_coalesce_buffer` before `_coalesce_flushed` have already
+    // been accepted by libutp.
+    bool _cork = false;
+    std::chrono::milliseconds _coalesce_delay{0};
+    std::vector<unsigned char> _coalesce_buffer;
+    size_t _coalesce_flushed = 0;
+    boost::asio::steady_timer _coalesce_timer;
+    bool _coalesce_timer_armed = false;
+
+    // Received data not yet read by the user. Chunks come from the context's
+    // pool and their `size` only covers the part not yet consumed.
+    std::deque<chunk> _rx_buffer_queue;
+    detail::buffer_sequence<boost::asio::mutable_buffer> _rx_buffers;
+
+    // Set for `async_read_exactly`, which keeps `_recv_handler` until
+    // `_rx_buffers` is full. `_rx_buffers` is consumed as it's filled.
+    bool _read_exactly = false;
+    size_t _rx_transferred = 0;
+
+    // Buffers registered with `socket::provide_buffers`, identified by their
+    // index. Received data is written into `_provided_filling` until it is
+    // full or a reader asks for it, then it moves to `_provided_filled`
+    // (index and length) and stays out of the pool until recycled.
+    std::vector<boost::asio::mutable_buffer> _provided_buffers;
+    std::deque<size_t> _provided_free;
+    std::deque<provided_buffer> _provided_filled;
+    size_t _provided_filling = 0;
+    size_t _provided_filling_size = 0;
+    bool _has_provided_filling = false;
+
+    // The message being reassembled by `async_receive_message`.
+    std::vector<unsigned char> _rx_message;
+    size_t _rx_message_size = 0;
+    bool _rx_message_header_done = false;
+    size_t _max_message_size = 16 * 1024 * 1024;
+
+    // Unreliable datagrams (`async_send_datagram`). The context hands them
+    // over based on `_remote_endpoint`; while nobody is receiving, up to
+    // `max_queued_datagrams` of them wait in `_rx_datagrams`.
+    static const size_t max_queued_datagrams = 16;
+    endpoint_type _remote_endpoint;
+    detail::buffer_sequence<boost::asio::const_buffer> _tx_datagram_buffers;
+    detail::buffer_sequence<boost::asio::mutable_buffer> _rx_datagram_buffers;
+    std::deque<chunk> _rx_datagrams;
+
+    bool _immediate_completion = false;
+    static const size_t max_inline_completions = 16;
+    size_t _inline_completions = 0;
+
+    // Set through `socket::on_data`. Held by a shared_ptr so that it survives
+    // being replaced from within itself.
+    using data_handler_type = std::function<size_t( const sys::error_code&
+                                                  , boost::asio::const_buffer)>;
+    std::shared_ptr<data_handler_type> _data_handler;
 
     // This prevents `this` from being destroyed after `socket` is destroyed
     // until libutp destroys `this->_utp_socket` (there is some IO that is done
@@ -0,0 +1,610 @@
+#include <asio_utp/stream_multiplexer.hpp>
+#include "namespaces.hpp"
+
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <vector>
+
+using namespace std;
+using namespace asio_utp;
+
+const size_t stream_multiplexer::stream_window;
+const size_t stream_multiplexer::max_frame_payload;
+
+namespace asio_utp { namespace detail {
+
+enum class frame_type : uint8_t { open = 0, data = 1, window = 2, fin = 3 };
+
+static const size_t frame_header_size = 9;
+
+static void encode_header( unsigned char* p
+                         , frame_type t
+                         , uint32_t id
+                         , uint32_t len)
+{
+    p[0] = uint8_t(t);
+    p[1] = uint8_t(id  >> 24); p[2] = uint8_t(id  >> 16);
+    p[3] = uint8_t(id  >>  8); p[4] = uint8_t(id);
+    p[5] = uint8_t(len >> 24); p[6] = uint8_t(len >> 16);
+    p[7] = uint8_t(len >>  8); p[8] = uint8_t(len);
+}
+
+static uint32_t decode_u32(const unsigned char* p)
+{
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16)
+         | (uint32_t(p[2]) <<  8) |  uint32_t(p[3]);
+}
+
+template<class Buffers>
+static void consume(Buffers& bufs, size_t n)
+{
+    for (auto& b : bufs) {
+        if (n == 0) break;
+        size_t c = std::min(n, b.size());
+        b += c;
+        n -= c;
+    }
+}
+
+struct stream_state {
+    uint32_t id;
+    weak_ptr<stream_multiplexer_state> mux;
+
+    // Received data not yet read by the user.
+    deque<vector<unsigned char>> rx_queue;
+    size_t rx_offset = 0; // Into the front of `rx_queue`
+    size_t rx_window = stream_multiplexer::stream_window; // What the other end may still send
+    size_t rx_unacked = 0; // Read by the user but not yet given back to the other end
+    bool rx_fin = false;
+    buffer_sequence<asio::mutable_buffer> rx_buffers;
+    handler<size_t> rx_handler;
+
+    size_t tx_credit = stream_multiplexer::stream_window;
+    bool tx_scheduled = false;
+    bool tx_in_flight = false;
+    buffer_sequence<asio::const_buffer> tx_buffers;
+    handler<size_t> tx_handler;
+
+    // By the local end.
+    bool closed = false;
+};
+
+struct stream_multiplexer_state
+    : public enable_shared_from_this<stream_multiplexer_state>
+{
+    using role = stream_multiplexer::role;
+
+    stream_multiplexer_state(socket&& s, role r)
+        : sock(move(s))
+        , local_parity(r == role::client ? 1 : 0)
+        , next_id(r == role::client ? 1 : 2)
+    {}
+
+    bool is_local(uint32_t id) const { return id % 2 == local_parity; }
+
+    shared_ptr<stream_state> make_stream(uint32_t id)
+    {
+        auto s = make_shared<stream_state>();
+        s->id = id;
+        s->mux = shared_from_this();
+        streams[id] = s;
+        return s;
+    }
+
+    shared_ptr<stream_state> open_stream(sys::error_code& ec)
+    {
+        if (closed) {
+            ec = asio::error::bad_descriptor;
+            return nullptr;
+        }
+
+        uint32_t id = next_id;
+        next_id += 2;
+
+        auto s = make_stream(id);
+        queue_control(frame_type::open, id, 0);
+        pump_writes();
+        return s;
+    }
+
+    void accept(handler<stream>&& h)
+    {
+        if (closed) {
+            return h.post(asio::error::bad_descriptor, stream());
+        }
+
+        assert(!accept_handler);
+        accept_handler = move(h);
+        complete_accept();
+    }
+
+    void complete_accept()
+    {
+        if (!accept_handler || accept_queue.empty()) return;
+
+        auto s = move(accept_queue.front());
+        accept_queue.pop_front();
+
+        accept_handler.post(sys::error_code(), stream(sock.get_executor(), move(s)));
+    }
+
+    void read(stream_state& s, handler<size_t>&& h)
+    {
+        if (closed || s.closed) {
+            return h.post(asio::error::bad_descriptor, 0);
+        }
+
+        assert(!s.rx_handler);
+
+        if (asio::buffer_size(s.rx_buffers) == 0) {
+            return h.post(sys::error_code(), 0);
+        }
+
+        s.rx_handler = move(h);
+        complete_read(s);
+    }
+
+    void complete_read(stream_state& s)
+    {
+        if (!s.rx_handler) return;
+
+        size_t n = 0;
+
+        while (!s.rx_queue.empty() && asio::buffer_size(s.rx_buffers)) {
+            auto& f = s.rx_queue.front();
+
+            size_t c = asio::buffer_copy( s.rx_buffers
+                                        , asio::buffer(f) + s.rx_offset);
+            consume(s.rx_buffers, c);
+            s.rx_offset += c;
+            n += c;
+
+            if (s.rx_offset == f.size()) {
+                s.rx_queue.pop_front();
+                s.rx_offset = 0;
+            }
+        }
+
+        if (n == 0) {
+            if (!s.rx_fin) return;
+            return s.rx_handler.post(asio::error::connection_reset, 0);
+        }
+
+        // Give the credit back in batches, there's no point in sending an
+        // update for every small read.
+        s.rx_unacked += n;
+
+        if (s.rx_unacked >= stream_multiplexer::stream_window / 2) {
+            queue_control(frame_type::window, s.id, s.rx_unacked);
+            s.rx_window += s.rx_unacked;
+            s.rx_unacked = 0;
+            pump_writes();
+        }
+
+        s.rx_handler.post(sys::error_code(), n);
+    }
+
+    void write(const shared_ptr<stream_state>& s, handler<size_t>&& h)
+    {
+        if (closed || s->closed) {
+            return h.post(asio::error::bad_descriptor, 0);
+        }
+
+        assert(!s->tx_handler);
+
+        if (asio::buffer_size(s->tx_buffers) == 0) {
+            return h.post(sys::error_code(), 0);
+        }
+
+        s->tx_handler = move(h);
+        schedule(s);
+        pump_writes();
+    }
+
+    // Streams with data and credit wait in `ready`, each one sends a single
+    // frame when its turn comes.
+    void schedule(const shared_ptr<stream_state>& s)
+    {
+        if (s->tx_scheduled || s->tx_in_flight) return;
+        if (!s->tx_handler || s->tx_credit == 0) return;
+
+        s->tx_scheduled = true;
+        ready.push_back(s);
+    }
+
+    void queue_control(frame_type t, uint32_t id, uint32_t len)
+    {
+        size_t n = control.size();
+        control.resize(n + frame_header_size);
+        encode_header(control.data() + n, t, id, len);
+    }
+
+    void pump_writes()
+    {
+        if (writing || closed) return;
+
+        auto self = shared_from_this();
+
+        // Control frames go first, they are small and unblock the other end.
+        if (!control.empty()) {
+            tx_control.swap(control);
+            control.clear();
+
+            writing = true;
+
+            sock.async_write_all(asio::buffer(tx_control),
+                [self] (const sys::error_code& ec, size_t) {
+                    self->writing = false;
+                    if (self->closed) return;
+                    if (ec) return self->close(ec);
+                    self->pump_writes();
+                });
+
+            return;
+        }
+
+        while (!ready.empty()) {
+            auto s = move(ready.front());
+            ready.pop_front();
+
+            s->tx_scheduled = false;
+
+            if (s->closed || !s->tx_handler) continue;
+
+            size_t n = std::min({ asio::buffer_size(s->tx_buffers)
+                                , s->tx_credit
+                                , stream_multiplexer::max_frame_payload });
+
+            if (n == 0) continue;
+
+            encode_header(tx_header, frame_type::data, s->id, n);
+
+            tx_frame.clear();
+            tx_frame.push_back(asio::buffer(tx_header));
+
+            size_t left = n;
+
+            for (auto& b : s->tx_buffers) {
+                if (left == 0) break;
+                size_t c = std::min(left, b.size());
+                if (c) tx_frame.push_back(asio::buffer(b.data(), c));
+                left -= c;
+            }
+
+            s->tx_credit -= n;
+            s->tx_in_flight = true;
+            writing = true;
+
+            sock.async_write_all(tx_frame,
+                [self, s, n] (const sys::error_code& ec, size_t) {
+                    self->writing = false;
+                    s->tx_in_flight = false;
+
+                    if (self->closed) {
+                        // A stream erased from `streams` while its frame was
+                        // in flight was missed by `close`.
+                        if (s->tx_handler) {
+                            s->tx_handler.post( ec ? ec : asio::error::operation_aborted
+                                              , 0);
+                        }
+                        return;
+                    }
+
+                    if (ec) return self->close(ec);
+                    s->tx_handler.post(sys::error_code(), n);
+                    self->pump_writes();
+                });
+
+            return;
+        }
+    }
+
+    void start()
+    {
+        read_header();
+    }
+
+    void read_header()
+    {
+        auto self = shared_from_this();
+
+        sock.async_read_exactly(asio::buffer(rx_header),
+            [self] (const sys::error_code& ec, size_t) {
+                if (self->closed) return;
+                if (ec) return self->close(ec);
+                self->on_header();
+            });
+    }
+
+    void on_header()
+    {
+        auto type = frame_type(rx_header[0]);
+        uint32_t id  = decode_u32(rx_header + 1);
+        uint32_t len = decode_u32(rx_header + 5);
+
+        if (type != frame_type::data) {
+            on_control(type, id, len);
+            if (!closed) read_header();
+            return;
+        }
+
+        if (len == 0 || len > stream_multiplexer::max_frame_payload) {
+            return protocol_error();
+        }
+
+        rx_payload.resize(len);
+
+        auto self = shared_from_this();
+
+        sock.async_read_exactly(asio::buffer(rx_payload),
+            [self, id] (const sys::error_code& ec, size_t) {
+                if (self->closed) return;
+                if (ec) return self->close(ec);
+                self->on_data(id);
+                if (!self->closed) self->read_header();
+            });
+    }
+
+    void on_control(frame_type type, uint32_t id, uint32_t len)
+    {
+        switch (type) {
+            case frame_type::open: {
+                if (id == 0 || is_local(id) || streams.count(id)) {
+                    return protocol_error();
+                }
+                accept_queue.push_back(make_stream(id));
+                complete_accept();
+                return;
+            }
+            case frame_type::window: {
+                // The stream may already be gone on our side.
+                auto i = streams.find(id);
+                if (i == streams.end()) return;
+                i->second->tx_credit += len;
+                schedule(i->second);
+                pump_writes();
+                return;
+            }
+            case frame_type::fin: {
+                auto i = streams.find(id);
+                if (i == streams.end() || i->second->rx_fin) {
+                    return protocol_error();
+                }
+                auto s = i->second;
+                s->rx_fin = true;
+                if (s->closed) streams.erase(i);
+                else complete_read(*s);
+                return;
+            }
+            default: return protocol_error();
+        }
+    }
+
+    void on_data(uint32_t id)
+    {
+        auto i = streams.find(id);
+        if (i == streams.end()) return protocol_error();
+
+        auto& s = *i->second;
+        size_t len = rx_payload.size();
+
+        if (s.rx_fin || len > s.rx_window) return protocol_error();
+
+        if (s.closed) {
+            // Nobody is going to read it, don't let the other end stall.
+            queue_control(frame_type::window, id, len);
+            pump_writes();
+            return;
+        }
+
+        s.rx_window -= len;
+        s.rx_queue.push_back(move(rx_payload));
+        rx_payload = vector<unsigned char>();
+
+        complete_read(s);
+    }
+
+    void close_stream(const shared_ptr<stream_state>& s)
+    {
+        if (s->closed) return;
+        s->closed = true;
+
+        if (s->rx_handler) {
+            s->rx_handler.post(asio::error::operation_aborted, 0);
+        }
+
+        // A frame in flight still refers to the user's buffers, that write
+        // completes once the frame has been handed over to the socket.
+        if (s->tx_handler && !s->tx_in_flight) {
+            s->tx_handler.post(asio::error::operation_aborted, 0);
+        }
+
+        if (closed) return;
+
+        size_t unread = s->rx_unacked;
+        for (auto& f : s->rx_queue) unread += f.size();
+        unread -= s->rx_offset;
+        s->rx_queue.clear();
+
+        queue_control(frame_type::fin, s->id, 0);
+        if (unread) queue_control(frame_type::window, s->id, unread);
+        pump_writes();
+
+        if (s->rx_fin) streams.erase(s->id);
+    }
+
+    void protocol_error()
+    {
+        close(sys::errc::make_error_code(sys::errc::protocol_error));
+    }
+
+    void close(const sys::error_code& ec)
+    {
+        if (closed) return;
+        closed = true;
+
+        sock.close();
+
+        if (accept_handler) accept_handler.post(ec, stream());
+
+        for (auto& p : streams) {
+            auto& s = *p.second;
+            if (s.rx_handler) s.rx_handler.post(ec, 0);
+            if (s.tx_handler) s.tx_handler.post(ec, 0);
+        }
+
+        streams.clear();
+        accept_queue.clear();
+        ready.clear();
+    }
+
+    socket sock;
+    uint32_t local_parity;
+    uint32_t next_id;
+    bool closed = false;
+
+    map<uint32_t, shared_ptr<stream_state>> streams;
+
+    deque<shared_ptr<stream_state>> accept_queue;
+    handler<stream> accept_handler;
+
+    deque<shared_ptr<stream_state>> ready;
+    vector<unsigned char> control;
+    vector<unsigned char> tx_control;
+    unsigned char tx_header[frame_header_size];
+    vector<asio::const_buffer> tx_frame;
+    bool writing = false;
+
+    unsigned char rx_header[frame_header_size];
+    vector<unsigned char> rx_payload;
+};
+
+}} // namespaces
+
+using detail::stream_multiplexer_state;
+
+//--------------------------------------------------------------------
+// stream
+//--------------------------------------------------------------------
+stream::stream(const executor_type& ex, shared_ptr<detail::stream_state> s)
+    : _ex(ex)
+    , _state(move(s))
+{}
+
+stream& stream::operator=(stream&& other)
+{
+    if (this == &other) return *this;
+    close();
+    _ex = move(other._ex);
+    _state = move(other._state);
+    return *this;
+}
+
+uint32_t stream::id() const
+{
+    assert(_state);
+    return _state->id;
+}
+
+bool stream::is_open() const
+{
+    if (!_state || _state->closed) return false;
+    auto mux = _state->mux.lock();
+    return mux && !mux->closed;
+}
+
+void stream::close()
+{
+    if (!_state) return;
+
+    if (auto mux = _state->mux.lock()) {
+        mux->close_stream(_state);
+    } else {
+        _state->closed = true;
+    }
+}
+
+void stream::do_read(handler<size_t>&& h)
+{
+    auto mux = _state ? _state->mux.lock() : nullptr;
+    if (!mux) return h.post(asio::error::bad_descriptor, 0);
+    mux->read(*_state, move(h));
+}
+
+void stream::do_write(handler<size_t>&& h)
+{
+    auto mux = _state ? _state->mux.lock() : nullptr;
+    if (!mux) return h.post(asio::error::bad_descriptor, 0);
+    mux->write(_state, move(h));
+}
+
+detail::buffer_sequence<asio::const_buffer>* stream::tx_buffers()
+{
+    if (!_state) return nullptr;
+    return &_state->tx_buffers;
+}
+
+detail::buffer_sequence<asio::mutable_buffer>* stream::rx_buffers()
+{
+    if (!_state) return nullptr;
+    return &_state->rx_buffers;
+}
+
+stream::~stream()
+{
+    close();
+}
+
+//--------------------------------------------------------------------
+// stream_multiplexer
+//--------------------------------------------------------------------
+stream_multiplexer::stream_multiplexer(socket&& s, role r)
+    : _ex(s.get_executor())
+    , _state(make_shared<stream_multiplexer_state>(move(s), r))
+{
+    _state->start();
+}
+
+stream stream_multiplexer::open_stream(sys::error_code& ec)
+{
+    if (!_state) {
+        ec = asio::error::bad_descriptor;
+        return stream();
+    }
+
+    auto s = _state->open_stream(ec);
+    if (ec) return stream();
+    return stream(_ex, move(s));
+}
+
+void stream_multiplexer::do_accept(handler<stream>&& h)
+{
+    if (!_state) return h.post(asio::error::bad_descriptor, stream());
+    _state->accept(move(h));
+}
+
+bool stream_multiplexer::is_open() const
+{
+    return _state && !_state->closed;
+}
+
+stream_multiplexer& stream_multiplexer::operator=(stream_multiplexer&& other)
+{
+    if (this == &other) return *this;
+    close();
+    _ex = move(other._ex);
+    _state = move(other._state);
+    return *this;
+}
+
+void stream_multiplexer::close()
+{
+    if (!_state) return;
+    _state->close(asio::error::operation_aborted);
+}
+
+stream_multiplexer::~stream_multiplexer()
+{
+    close();
+}
@@ -4,20 +4,37 @@
 
 using namespace std;
 using namespace asio_utp;
+using detail::udp_multiplexer_base;
 
-struct udp_multiplexer::state {
+struct udp_multiplexer_base::state {
     udp_multiplexer_impl::recv_entry recv_entry;
 
-    udp_multiplexer::endpoint_type* rx_ep = nullptr;
+    udp_multiplexer_base::endpoint_type* rx_ep = nullptr;
+
+    // Must outlive the handlers below.
+    detail::handler_memory tx_handler_memory;
+    detail::handler_memory rx_handler_memory;
 
     handler<size_t> tx_handler;
     handler<size_t> rx_handler;
 
-    vector<asio::mutable_buffer> rx_buffers;
-    vector<asio::const_buffer>   tx_buffers;
+    detail::buffer_sequence<asio::mutable_buffer> rx_buffers;
+    detail::buffer_sequence<asio::const_buffer>   tx_buffers;
 
     std::shared_ptr<udp_multiplexer_impl> impl;
 
+    // Created on first use of the libutp options, the same one the sockets
+    // bound to `impl` use.
+    std::shared_ptr<::asio_utp::context> context;
+
+    ::asio_utp::context& get_context() {
+        if (!context) {
+            auto& ctx = impl->get_executor().context();
+            context = asio::use_service<service>(ctx).maybe_create_context(impl);
+        }
+        return *context;
+    }
+
     void handle_read( const sys::error_code& ec
                     , const endpoint_type& ep
                     , const uint8_t* data
@@ -30,16 +47,12 @@ struct udp_multiplexer::state {
     }
 };
 
-udp_multiplexer::udp_multiplexer(boost::asio::io_context& ioc)
-    : _ex(ioc.get_executor())
+udp_multiplexer_base::udp_multiplexer_base(const boost::asio::executor& ex)
+    : _impl_ex(ex)
 {}
 
-udp_multiplexer::udp_multiplexer(const boost::asio::executor& ex)
-    : _ex(ex)
-{}
-
-void udp_multiplexer::bind( const endpoint_type& local_ep
-                          , sys::error_code& ec)
+void udp_multiplexer_base::bind( const endpoint_type& local_ep
+                               , sys::error_code& ec)
 {
     using namespace std::placeholders;
 
@@ -47,10 +60,10 @@ void udp_multiplexer::bind( const endpoint_type& local_ep
     sys::error_code ec_ignored;
     if (_state) close(ec_ignored);
 
-    auto& ctx = _ex.context();
+    auto& ctx = _impl_ex.context();
 
     auto impl = asio::use_service<service>(ctx)
-        .maybe_create_udp_multiplexer(_ex, local_ep, ec);
+        .maybe_create_udp_multiplexer(_impl_ex, local_ep, ec);
 
     if (ec) return;
 
@@ -62,8 +75,8 @@ void udp_multiplexer::bind( const endpoint_type& local_ep
         = std::bind(&state::handle_read, _state, _1, _2, _3, _4);
 }
 
-void udp_multiplexer::bind( const udp_multiplexer& other
-                          , sys::error_code& ec)
+void udp_multiplexer_base::bind( const udp_multiplexer_base& other
+                               , sys::error_code& ec)
 {
     using namespace std::placeholders;
 
@@ -81,13 +94,13 @@ void udp_multiplexer::bind( const udp_multiplexer& other
         = std::bind(&state::handle_read, _state, _1, _2, _3, _4);
 }
 
-shared_ptr<udp_multiplexer_impl> udp_multiplexer::impl() const
+shared_ptr<udp_multiplexer_impl> udp_multiplexer_base::impl() const
 {
     assert(_state);
     return _state->impl;
 }
 
-void udp_multiplexer::do_send(const endpoint_type& dst, handler<size_t>&& h)
+void udp_multiplexer_base::do_send(const endpoint_type& dst, handler<size_t>&& h)
 {
     if (!_state) {
         return h.post(asio::error::bad_descriptor, 0);
@@ -104,7 +117,7 @@ void udp_multiplexer::do_send(const endpoint_type& dst, handler<size_t>&& h)
         });
 }
 
-void udp_multiplexer::do_receive(endpoint_type& ep, handler<size_t>&& h)
+void udp_multiplexer_base::do_receive(endpoint_type& ep, handler<size_t>&& h)
 {
     if (!_state) {
         return h.post(asio::error::bad_descriptor, 0);
@@ -118,24 +131,192 @@ void udp_multiplexer::do_receive(endpoint_type& ep, handler<size_t>&& h)
     _state->impl->register_recv_handler(_state->recv_entry);
 }
 
-udp_multiplexer::on_send_to_connection udp_multiplexer::on_send_to(std::function<on_send_to_handler> handler)
+udp_multiplexer_base::on_send_to_connection udp_multiplexer_base::on_send_to(std::function<on_send_to_handler> handler)
 {
     assert(_state);
     return _state->impl->on_send_to(std::move(handler));
 }
 
-udp_multiplexer::endpoint_type udp_multiplexer::local_endpoint() const
+udp_multiplexer_base::endpoint_type udp_multiplexer_base::local_endpoint() const
 {
     assert(_state);
     return _state->impl->local_endpoint();
 }
 
-bool udp_multiplexer::is_open() const
+bool udp_multiplexer_base::is_open() const
 {
     return bool(_state);
 }
 
-void udp_multiplexer::close(boost::system::error_code& ec)
+void udp_multiplexer_base::set_utp_option(int opt, int value, sys::error_code& ec)
+{
+    if (!_state) {
+        ec = asio::error::bad_descriptor;
+        return;
+    }
+
+    auto& ctx = _state->get_context();
+    utp_context_set_option(ctx.get_libutp_context(), opt, value);
+}
+
+int udp_multiplexer_base::get_utp_option(int opt, sys::error_code& ec) const
+{
+    if (!_state) {
+        ec = asio::error::bad_descriptor;
+        return 0;
+    }
+
+    auto& ctx = _state->get_context();
+    return utp_context_get_option(ctx.get_libutp_context(), opt);
+}
+
+void udp_multiplexer_base::set_option(const target_delay& opt, sys::error_code& ec)
+{
+    int v;
+
+    if (!util::to_utp_option_value(opt.value(), v)) {
+        ec = asio::error::invalid_argument;
+        return;
+    }
+
+    set_utp_option(UTP_TARGET_DELAY, v, ec);
+}
+
+void udp_multiplexer_base::get_option(target_delay& opt, sys::error_code& ec) const
+{
+    auto us = chrono::microseconds(get_utp_option(UTP_TARGET_DELAY, ec));
+    if (ec) return;
+    opt = target_delay(chrono::duration_cast<chrono::milliseconds>(us));
+}
+
+void udp_multiplexer_base::set_option(const send_buffer_size& opt, sys::error_code& ec)
+{
+    int v;
+
+    if (!util::to_utp_option_value(opt.value(), v)) {
+        ec = asio::error::invalid_argument;
+        return;
+    }
+
+    set_utp_option(UTP_SNDBUF, v, ec);
+}
+
+void udp_multiplexer_base::get_option(send_buffer_size& opt, sys::error_code& ec) const
+{
+    auto v = get_utp_option(UTP_SNDBUF, ec);
+    if (ec) return;
+    opt = send_buffer_size(v);
+}
+
+void udp_multiplexer_base::set_option(const receive_buffer_size& opt, sys::error_code& ec)
+{
+    int v;
+
+    if (!util::to_utp_option_value(opt.value(), v)) {
+        ec = asio::error::invalid_argument;
+        return;
+    }
+
+    set_utp_option(UTP_RCVBUF, v, ec);
+}
+
+void udp_multiplexer_base::get_option(receive_buffer_size& opt, sys::error_code& ec) const
+{
+    auto v = get_utp_option(UTP_RCVBUF, ec);
+    if (ec) return;
+    opt = receive_buffer_size(v);
+}
+
+void udp_multiplexer_base::set_option(const ack_frequency& opt, sys::error_code& ec)
+{
+    if (!_state) {
+        ec = asio::error::bad_descriptor;
+        return;
+    }
+
+    _state->get_context().ack_frequency(opt.value());
+}
+
+void udp_multiplexer_base::get_option(ack_frequency& opt, sys::error_code& ec) const
+{
+    if (!_state) {
+        ec = asio::error::bad_descriptor;
+        return;
+    }
+
+    opt = ack_frequency(_state->get_context().ack_frequency());
+}
+
+void udp_multiplexer_base::set_option(const max_ack_delay& opt, sys::error_code& ec)
+{
+    if (!_state) {
+        ec = asio::error::bad_descriptor;
+        return;
+    }
+
+    if (opt.value().count() <= 0) {
+        ec = asio::error::invalid_argument;
+        return;
+    }
+
+    _state->get_context().max_ack_delay(opt.value());
+}
+
+void udp_multiplexer_base::get_option(max_ack_delay& opt, sys::error_code& ec) const
+{
+    if (!_state) {
+        ec = asio::error::bad_descriptor;
+        return;
+    }
+
+    opt = max_ack_delay(_state->get_context().max_ack_delay());
+}
+
+void udp_multiplexer_base::set_option( const asio::socket_base::receive_buffer_size& opt
+                                     , sys::error_code& ec)
+{
+    if (!_state) {
+        ec = asio::error::bad_descriptor;
+        return;
+    }
+
+    _state->impl->set_option(opt, ec);
+}
+
+void udp_multiplexer_base::get_option( asio::socket_base::receive_buffer_size& opt
+                                     , sys::error_code& ec) const
+{
+    if (!_state) {
+        ec = asio::error::bad_descriptor;
+        return;
+    }
+
+    _state->impl->get_option(opt, ec);
+}
+
+void udp_multiplexer_base::set_option( const asio::socket_base::send_buffer_size& opt
+                                     , sys::error_code& ec)
+{
+    if (!_state) {
+        ec = asio::error::bad_descriptor;
+        return;
+    }
+
+    _state->impl->set_option(opt, ec);
+}
+
+void udp_multiplexer_base::get_option( asio::socket_base::send_buffer_size& opt
+                                     , sys::error_code& ec) const
+{
+    if (!_state) {
+        ec = asio::error::bad_descriptor;
+        return;
+    }
+
+    _state->impl->get_option(opt, ec);
+}
+
+void udp_multiplexer_base::close(boost::system::error_code& ec)
 {
     if (!_state) {
         ec = asio::error::bad_descriptor;
@@ -157,25 +338,38 @@ void udp_multiplexer::close(boost::system::error_code& ec)
     // `_state` may be kept from being destroyed by handlers, so make sure we
     // don't unnecessarily keep the udp_multiplexer_impl from being destroyed
     // as well.
+    _state->context = nullptr;
     _state->impl = nullptr;
 
     _state = nullptr;
 }
 
-udp_multiplexer::~udp_multiplexer()
+udp_multiplexer_base::~udp_multiplexer_base()
 {
     sys::error_code ec;
     close(ec);
 }
 
-vector<asio::mutable_buffer>* udp_multiplexer::rx_buffers()
+detail::buffer_sequence<asio::mutable_buffer>* udp_multiplexer_base::rx_buffers()
 {
     if (!_state) return nullptr;
     return &_state->rx_buffers;
 }
 
-vector<asio::const_buffer>* udp_multiplexer::tx_buffers()
+detail::buffer_sequence<asio::const_buffer>* udp_multiplexer_base::tx_buffers()
 {
     if(!_state) return nullptr;
     return &_state->tx_buffers;
 }
+
+detail::handler_memory* udp_multiplexer_base::rx_handler_memory()
+{
+    if (!_state) return nullptr;
+    return &_state->rx_handler_memory;
+}
+
+detail::handler_memory* udp_multiplexer_base::tx_handler_memory()
+{
+    if (!_state) return nullptr;
+    return &_state->tx_handler_memory;
+}
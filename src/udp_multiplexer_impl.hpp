@@ -44,13 +44,16 @@ private:
 public:
     udp_multiplexer_impl(asio::ip::udp::socket);
 
-    std::size_t send_to( const std::vector<asio::const_buffer>&
+    template<typename ConstBufferSequence>
+    std::size_t send_to( const ConstBufferSequence&
                        , const endpoint_type& destination
                        , asio::socket_base::message_flags
                        , sys::error_code&);
 
-    template< typename WriteHandler>
-    void async_send_to( const std::vector<asio::const_buffer>&
+    // `buffers` must stay valid until the handler is invoked.
+    template< typename ConstBufferSequence
+            , typename WriteHandler>
+    void async_send_to( const ConstBufferSequence& buffers
                       , const endpoint_type&
                       , WriteHandler&&);
 
@@ -75,6 +78,16 @@ public:
 
     size_t available(sys::error_code&) const;
 
+    template<class Option>
+    void set_option(const Option& o, sys::error_code& ec) {
+        _udp_socket.set_option(o, ec);
+    }
+
+    template<class Option>
+    void get_option(Option& o, sys::error_code& ec) const {
+        _udp_socket.get_option(o, ec);
+    }
+
     ~udp_multiplexer_impl();
 
 private:
@@ -82,6 +95,12 @@ private:
     void flush_handlers(const sys::error_code& ec, size_t size);
     void on_recv_entry_unlinked();
 
+    template<typename ConstBufferSequence>
+    void notify_send_to( const ConstBufferSequence&
+                       , size_t
+                       , const endpoint_type&
+                       , const sys::error_code&);
+
     // For debugging only
     static
     std::string to_hex(uint8_t*, size_t);
@@ -223,39 +242,61 @@ void udp_multiplexer_impl::flush_handlers(const sys::error_code& ec, size_t size
     }
 }
 
+template<typename ConstBufferSequence>
 inline
-std::size_t udp_multiplexer_impl::send_to( const std::vector<asio::const_buffer>& buffers
+std::size_t udp_multiplexer_impl::send_to( const ConstBufferSequence& buffers
                                          , const endpoint_type& destination
                                          , asio::socket_base::message_flags flags
                                          , sys::error_code& ec)
 {
     if (_debug) {
         log(this, " udp_multiplexer::send_to");
-        for (auto b : buffers) {
+        for ( auto i = asio::buffer_sequence_begin(buffers)
+            ; i != asio::buffer_sequence_end(buffers)
+            ; ++i) {
+            asio::const_buffer b = *i;
             log(this, "    ", to_hex((uint8_t*)b.data(), b.size()));
         }
     }
 
     size_t sent = _udp_socket.send_to(buffers, destination, flags, ec);
 
-    _send_to_signal(buffers, sent, destination, ec);
+    notify_send_to(buffers, sent, destination, ec);
 
     return sent;
 }
 
-template< typename WriteHandler>
+// The signal's slots take a vector, but it's only built when someone is
+// actually listening.
+template<typename ConstBufferSequence>
+inline
+void udp_multiplexer_impl::notify_send_to( const ConstBufferSequence& buffers
+                                         , size_t sent
+                                         , const endpoint_type& destination
+                                         , const sys::error_code& ec)
+{
+    if (_send_to_signal.empty()) return;
+
+    std::vector<asio::const_buffer> v( asio::buffer_sequence_begin(buffers)
+                                     , asio::buffer_sequence_end(buffers));
+
+    _send_to_signal(v, sent, destination, ec);
+}
+
+template< typename ConstBufferSequence
+        , typename WriteHandler>
 inline
-void udp_multiplexer_impl::async_send_to( const std::vector<asio::const_buffer>& buffers
+void udp_multiplexer_impl::async_send_to( const ConstBufferSequence& buffers
                                         , const endpoint_type& dst
                                         , WriteHandler&& h)
 {
     _udp_socket.async_send_to(buffers, dst, [
         &buffers,
-        &dst,
+        dst,
         h = std::forward<WriteHandler>(h),
         self = shared_from_this()
     ] (const sys::error_code& ec, std::size_t bytes_transferred) mutable {
-        self->_send_to_signal(buffers, bytes_transferred, dst, ec);
+        self->notify_send_to(buffers, bytes_transferred, dst, ec);
         h(ec, bytes_transferred);
     });
 }
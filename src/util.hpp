@@ -1,10 +1,31 @@
 #pragma once
 
 #include <boost/asio/ip/udp.hpp>
+#include <chrono>
+#include <limits>
 #include "namespaces.hpp"
 
 namespace asio_utp { namespace util {
 
+// Libutp option values are ints, and it takes the target delay in
+// microseconds. Return false if the value doesn't make sense for libutp.
+inline
+bool to_utp_option_value(std::chrono::milliseconds d, int& out)
+{
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+    if (us <= 0 || us > std::numeric_limits<int>::max()) return false;
+    out = int(us);
+    return true;
+}
+
+inline
+bool to_utp_option_value(size_t v, int& out)
+{
+    if (v == 0 || v > size_t(std::numeric_limits<int>::max())) return false;
+    out = int(v);
+    return true;
+}
+
 inline
 sockaddr_in to_sockaddr_v4(const asio::ip::udp::endpoint& ep)
 {
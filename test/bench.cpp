@@ -3,9 +3,40 @@
  * to the server. The random bytes are predictable on the server and thus
  * checked for correctness. The benchmark can use the utp socket implemented in
  * this library or the asio::tcp sockets for comparison.
+ *
+ * With a `count` argument the client opens that many connections one after
+ * another, each transferring `size` bytes, which measures how quickly short
+ * transfers complete (handshake and window ramp up included). A transfer
+ * completes when the server acknowledges the last byte. Libutp's initial
+ * window and ramp up can't be tuned yet, see TODO in the README.
+ *
+ * The `utp-large-target` protocol is `utp` with the `ledbat_large_target`
+ * congestion controller. To see how it competes with TCP, run a `tcp` and a
+ * `utp` or `utp-large-target` pair at the same time over an impaired link,
+ * e.g. loopback with
+ * `tc qdisc add dev lo root netem delay 20ms rate 50mbit limit 100`.
+ *
+ * For paths with a large bandwidth-delay product, `--window=<bytes>` sizes
+ * the utp send and receive buffers (and the UDP socket buffers under them),
+ * and the `proxy` mode forwards UDP packets between a utp client and server
+ * with a fixed delay in each direction, emulating a long path without root:
+ *
+ *   bench server utp 127.0.0.1:5000 --window=33554432
+ *   bench proxy 127.0.0.1:5001 127.0.0.1:5000 50
+ *   bench client utp 127.0.0.1:5001 268435456 --window=33554432
+ *
+ * Until libutp's cap of 1023 packets in flight is raised (see TODO in the
+ * README), a utp sender keeps at most about 1.4MB in flight whatever the
+ * window, which limits it to about 115Mbit/s on this 100ms path.
+ *
+ * The utp server prints how many acknowledgements it sent per data packet
+ * received, `--ack-frequency=<packets>` sets the `ack_frequency` option.
+ * `--fec=<packets>` (on both ends) enables `forward_error_correction`, try
+ * it with e.g. `netem loss 2%`.
  */
 #include <iostream>
 #include <sstream>
+#include <deque>
 #include <boost/range.hpp>
 #include <boost/asio.hpp>
 #include <boost/asio/spawn.hpp>
@@ -21,17 +52,86 @@ namespace rnd = boost::random;
 using asio::ip::tcp;
 using asio::ip::udp;
 using Clock = std::chrono::steady_clock;
-using string_view = boost::string_view;
 
 enum class Type { client, server };
 
+utp::congestion_controller congestion_controller = utp::congestion_controller::ledbat;
+
+// Zero to leave the buffers at their defaults.
+size_t window = 0;
+
+// Zero to keep acknowledging every burst of received packets.
+size_t ack_frequency = 0;
+
+// Zero for no forward error correction.
+size_t fec = 0;
+
+void bind_socket(tcp::socket& s, const tcp::endpoint& ep)
+{
+    s.open(ep.protocol());
+    s.bind(ep);
+}
+
+void bind_socket(utp::socket& s, const udp::endpoint& ep)
+{
+    boost::system::error_code ec;
+
+    if (window) {
+        utp::udp_multiplexer m(s.get_executor());
+        m.bind(ep, ec);
+        assert(!ec);
+        m.set_option(asio::socket_base::receive_buffer_size(window), ec);
+        m.set_option(asio::socket_base::send_buffer_size(window), ec);
+        assert(!ec);
+        s.bind(m, ec);
+        assert(!ec);
+        s.set_option(utp::receive_buffer_size(window), ec);
+        s.set_option(utp::send_buffer_size(window), ec);
+        assert(!ec);
+    }
+    else {
+        s.bind(ep, ec);
+        assert(!ec);
+    }
+
+    s.set_option(utp::congestion_control(congestion_controller), ec);
+    assert(!ec);
+
+    if (ack_frequency) {
+        s.set_option(utp::ack_frequency(ack_frequency), ec);
+        assert(!ec);
+    }
+
+    if (fec) {
+        s.set_option(utp::forward_error_correction(fec), ec);
+        assert(!ec);
+    }
+}
+
+void print_stats(tcp::socket&) {}
+
+void print_stats(utp::socket& s)
+{
+    boost::system::error_code ec;
+    auto stats = s.get_context_stats(ec);
+    if (ec || !stats.data_packets_received) return;
+
+    cout << "Acks per data packet: "
+         << float(stats.acks_sent) / stats.data_packets_received << endl;
+
+    if (fec) {
+        cout << "Packets recovered by FEC: " << stats.fec_packets_recovered
+             << endl;
+    }
+}
+
 float seconds(Clock::duration d) {
     using namespace std::chrono;
     return duration_cast<milliseconds>(d).count() / 1000.f;
 }
 
 template<class Proto>
-typename Proto::endpoint parse_endpoint(const string_view s)
+typename Proto::endpoint parse_endpoint(const boost::string_view s)
 {
     auto pos = s.find(':');
 
@@ -47,33 +147,69 @@ typename Proto::endpoint parse_endpoint(const string_view s)
 }
 
 struct Handshake {
-    uint16_t seed;
+    uint32_t seed;
     uint32_t size;
+    // Number of connections the client makes.
+    uint32_t count;
+};
+
+struct Options {
+    uint32_t size = 1024*1024*8;
+    uint32_t count = 1;
 };
 
 template<typename Socket>
-Handshake handshake(Socket& s, Type type, asio::yield_context yield)
+Handshake handshake( Socket& s
+                   , Type type
+                   , const Options& opts
+                   , asio::yield_context yield)
 {
-    uint16_t seed = 0;
+    Handshake h;
 
     if (type == Type::client) {
         rnd::mt19937 rng(std::time(0));
         rnd::uniform_int_distribution<> byte(0, numeric_limits<uint16_t>::max());
-        seed = byte(rng);
+        h = { uint32_t(byte(rng)), opts.size, opts.count };
 
-        asio::async_write(s, asio::buffer(&seed, sizeof(seed)), yield);
+        asio::async_write(s, asio::buffer(&h, sizeof(h)), yield);
     }
     else {
-        asio::async_read(s, asio::buffer(&seed, sizeof(seed)), yield);
+        asio::async_read(s, asio::buffer(&h, sizeof(h)), yield);
     }
 
-    return {seed, 1024*1024*8 };
+    return h;
 }
 
+// The uTP socket can transfer the whole buffer with a single completion.
+template<typename Socket, typename Buffers>
+size_t read_all(Socket& s, const Buffers& b, asio::yield_context yield)
+{
+    return asio::async_read(s, b, yield);
+}
+
+template<typename Buffers>
+size_t read_all(utp::socket& s, const Buffers& b, asio::yield_context yield)
+{
+    return s.async_read_exactly(b, yield);
+}
+
+template<typename Socket, typename Buffers>
+size_t write_all(Socket& s, const Buffers& b, asio::yield_context yield)
+{
+    return asio::async_write(s, b, yield);
+}
+
+template<typename Buffers>
+size_t write_all(utp::socket& s, const Buffers& b, asio::yield_context yield)
+{
+    return s.async_write_all(b, yield);
+}
+
+// Returns the number of connections the client is going to make.
 template<typename Socket>
-void receive(Socket& s, Type type, asio::yield_context yield)
+uint32_t receive(Socket& s, Type type, asio::yield_context yield)
 {
-    auto h = handshake(s, type, yield);
+    auto h = handshake(s, type, Options(), yield);
     rnd::mt19937 rng(h.seed);
     boost::random::uniform_int_distribution<> random_byte(0, 255);
 
@@ -85,7 +221,7 @@ void receive(Socket& s, Type type, asio::yield_context yield)
 
     while (to_receive) {
         cout << "receiving " << endl;
-        size_t size = asio::async_read(s, asio::buffer(buffer), yield);
+        size_t size = read_all(s, asio::buffer(buffer), yield);
 
         if (size > to_receive) {
             throw std::runtime_error("Received more than was supposed to");
@@ -105,13 +241,20 @@ void receive(Socket& s, Type type, asio::yield_context yield)
         to_receive -= size;
     }
 
+    uint8_t ack = 0;
+    asio::async_write(s, asio::buffer(&ack, 1), yield);
+
     cout << "Took: " << seconds(Clock::now() - start) << "s" << endl;
+
+    print_stats(s);
+
+    return h.count;
 }
 
 template<typename Socket>
-void send(Socket& s, Type type, asio::yield_context yield)
+void send(Socket& s, Type type, const Options& opts, asio::yield_context yield)
 {
-    auto h = handshake(s, type, yield);
+    auto h = handshake(s, type, opts, yield);
     rnd::mt19937 rng(h.seed);
     boost::random::uniform_int_distribution<> random_byte(0, 255);
 
@@ -128,24 +271,25 @@ void send(Socket& s, Type type, asio::yield_context yield)
     auto start = Clock::now();
 
     while (buf.size()) {
-        size_t size = asio::async_write(s, buf, yield);
+        size_t size = write_all(s, buf, yield);
         buf += size;
         cout << "wrote " << size << " bytes " << buf.size() << endl;
     }
 
+    uint8_t ack;
+    asio::async_read(s, asio::buffer(&ack, 1), yield);
+
     cout << "Took: " << seconds(Clock::now() - start) << "s" << endl;
 }
 
 template<typename Proto>
 typename Proto::socket connect( asio::io_context& ioc
-                              , string_view remote_ep_s
+                              , boost::string_view remote_ep_s
                               , asio::yield_context yield)
 {
     auto remote_ep = parse_endpoint<Proto>(remote_ep_s);
     typename Proto::socket socket(ioc);
-    boost::system::error_code ec;
-    socket.bind({asio::ip::address_v4::any(), 0}, ec);
-    assert(!ec);
+    bind_socket(socket, {asio::ip::address_v4::any(), 0});
     socket.async_connect(remote_ep, yield);
     return socket;
 }
@@ -155,7 +299,7 @@ template<typename Proto> struct Async;
 template<> struct Async<tcp> {
     static
     tcp::socket accept( asio::io_context& ioc
-                      , string_view local_ep_s
+                      , boost::string_view local_ep_s
                       , asio::yield_context yield)
     {
         auto local_ep = parse_endpoint<tcp>(local_ep_s);
@@ -171,15 +315,13 @@ template<> struct Async<tcp> {
 template<> struct Async<utp::protocol> {
     static
     utp::socket accept( asio::io_context& ioc
-                      , string_view local_ep_s
+                      , boost::string_view local_ep_s
                       , asio::yield_context yield)
     {
         auto local_ep = parse_endpoint<utp::protocol>(local_ep_s);
     
-        boost::system::error_code ec;
         utp::socket socket(ioc);
-        socket.bind(local_ep, ec);
-        assert(!ec);
+        bind_socket(socket, local_ep);
         socket.async_accept(yield);
     
         return socket;
@@ -188,44 +330,172 @@ template<> struct Async<utp::protocol> {
 
 template<class Proto>
 void server( asio::io_context& ioc
-           , string_view local_ep_s
+           , boost::string_view local_ep_s
            , asio::yield_context yield)
 {
-    cout << "Accepting..." << endl;
-    auto socket = Async<Proto>::accept(ioc, local_ep_s, yield);
-    cout << "Receiving..." << endl;
-    receive(socket, Type::server, yield);
+    uint32_t count = 1;
+
+    for (uint32_t i = 0; i < count; ++i) {
+        cout << "Accepting..." << endl;
+        auto socket = Async<Proto>::accept(ioc, local_ep_s, yield);
+        cout << "Receiving..." << endl;
+        count = receive(socket, Type::server, yield);
+    }
+
     cout << "Done" << endl;
 }
 
 template<class Proto>
 void client( asio::io_context& ioc
-           , string_view remote_ep_s
+           , boost::string_view remote_ep_s
+           , const Options& opts
            , asio::yield_context yield)
 {
-    cout << "Connecting..." << endl;
-    auto socket = connect<Proto>(ioc, remote_ep_s, yield);
-    cout << "Sending..." << endl;
-    send(socket, Type::client, yield);
+    Clock::duration total{0};
+
+    for (uint32_t i = 0; i < opts.count; ++i) {
+        auto start = Clock::now();
+        cout << "Connecting..." << endl;
+        auto socket = connect<Proto>(ioc, remote_ep_s, yield);
+        cout << "Sending..." << endl;
+        send(socket, Type::client, opts, yield);
+        auto took = Clock::now() - start;
+        total += took;
+        cout << "Transfer #" << i << " including connect took: "
+             << seconds(took) << "s" << endl;
+    }
+
+    if (opts.count > 1) {
+        cout << "Average transfer of " << opts.size << " bytes took: "
+             << seconds(total / opts.count) << "s" << endl;
+    }
+
     cout << "Done" << endl;
 }
 
+// Forwards packets from whoever talks to `local_ep` to `remote_ep` and the
+// responses back, each `delay` after it arrived. Runs until killed.
+void proxy( asio::io_context& ioc
+          , const udp::endpoint& local_ep
+          , const udp::endpoint& remote_ep
+          , Clock::duration delay
+          , asio::yield_context yield)
+{
+    struct Packet {
+        Clock::time_point due;
+        udp::endpoint to;
+        vector<uint8_t> data;
+    };
+
+    udp::socket socket(ioc, local_ep);
+    asio::steady_timer timer(ioc);
+    // Ordered by `due` as the delay is the same for all.
+    deque<Packet> queue;
+
+    asio::spawn(ioc, [&] (asio::yield_context yield) {
+        boost::system::error_code ec;
+
+        while (true) {
+            if (queue.empty()) {
+                timer.expires_at(Clock::time_point::max());
+            } else {
+                timer.expires_at(queue.front().due);
+            }
+
+            // Cancelled when a packet comes to an empty queue.
+            timer.async_wait(yield[ec]);
+
+            while (!queue.empty() && queue.front().due <= Clock::now()) {
+                auto& p = queue.front();
+                socket.send_to(asio::buffer(p.data), p.to, 0, ec);
+                queue.pop_front();
+            }
+        }
+    });
+
+    udp::endpoint client_ep;
+    vector<uint8_t> buffer(65536);
+
+    while (true) {
+        udp::endpoint from;
+        size_t size = socket.async_receive_from(asio::buffer(buffer), from, yield);
+
+        if (from != remote_ep) client_ep = from;
+        if (client_ep == udp::endpoint()) continue;
+
+        auto to = from == remote_ep ? client_ep : remote_ep;
+
+        queue.push_back(Packet{ Clock::now() + delay
+                              , to
+                              , vector<uint8_t>(buffer.begin(), buffer.begin() + size)});
+
+        if (queue.size() == 1) timer.cancel();
+    }
+}
 
 void usage(const char* app, const char* what = nullptr) {
     if (what) {
         cout << what << "\n" << endl;
     }
     cout << "Usage:" << endl;
-    cout << "  " << app << " [client|server] [tcp|utp] <endpoint>" << endl;
+    cout << "  " << app << " [client|server] [tcp|utp|utp-large-target] <endpoint> [<size> [<count>]] [--window=<bytes>] [--ack-frequency=<packets>] [--fec=<packets>]" << endl;
+    cout << "  " << app << " proxy <local endpoint> <server endpoint> <one way delay in ms>" << endl;
+    cout << "  (size and count are only used by the client)" << endl;
 }
 
-int main(int argc, const char** argv)
+int main(int argc_, const char** argv_)
 {
+    // Positional arguments, without the `--` options.
+    vector<const char*> args;
+
+    for (int i = 0; i < argc_; ++i) {
+        string arg = argv_[i];
+
+        if (arg.compare(0, 9, "--window=") == 0) {
+            window = std::atoll(arg.c_str() + 9);
+        } else if (arg.compare(0, 16, "--ack-frequency=") == 0) {
+            ack_frequency = std::atoll(arg.c_str() + 16);
+        } else if (arg.compare(0, 6, "--fec=") == 0) {
+            fec = std::atoll(arg.c_str() + 6);
+        } else {
+            args.push_back(argv_[i]);
+        }
+    }
+
+    int argc = args.size();
+    const char** argv = args.data();
+
     if (argc < 4) {
         usage(argv[0], "Wrong number of arguments");
         return 1;
     }
 
+    if (argv[1] == string("proxy")) {
+        if (argc < 5) {
+            usage(argv[0], "Wrong number of arguments");
+            return 1;
+        }
+
+        try {
+            asio::io_context ioc(1);
+
+            asio::spawn(ioc, [&] (asio::yield_context yield) {
+                    proxy( ioc
+                         , parse_endpoint<udp>(argv[2])
+                         , parse_endpoint<udp>(argv[3])
+                         , chrono::milliseconds(std::atoi(argv[4]))
+                         , yield);
+                });
+
+            ioc.run();
+        }
+        catch (std::exception& e) {
+            cout << e.what() << endl;
+        }
+
+        return 0;
+    }
+
     Type type;
 
     if (argv[1] == string("client")) {
@@ -239,27 +509,41 @@ int main(int argc, const char** argv)
 
     string proto = argv[2];
 
-    if (proto != "tcp" && proto != "utp") {
+    if (proto != "tcp" && proto != "utp" && proto != "utp-large-target") {
         usage(argv[0], "Wrong protocol");
         return 1;
     }
 
+    if (proto == "utp-large-target") {
+        congestion_controller = utp::congestion_controller::ledbat_large_target;
+    }
+
     string endpoint = argv[3];
 
+    Options opts;
+
+    if (argc > 4) opts.size = std::atoi(argv[4]);
+    if (argc > 5) opts.count = std::atoi(argv[5]);
+
+    if (opts.size == 0 || opts.count == 0) {
+        usage(argv[0], "Size and count must be positive");
+        return 1;
+    }
+
     try {
         asio::io_context ioc(1);
 
         asio::spawn(ioc, [&] (asio::yield_context yield) {
                 if (proto == "tcp") {
                     if (type == Type::client) {
-                        client<tcp>(ioc, endpoint, yield);
+                        client<tcp>(ioc, endpoint, opts, yield);
                     } else {
                         server<tcp>(ioc, endpoint, yield);
                     }
                 }
-                else /* proto == utp */ {
+                else /* proto == utp or utp-large-target */ {
                     if (type == Type::client) {
-                        client<utp::protocol>(ioc, endpoint, yield);
+                        client<utp::protocol>(ioc, endpoint, opts, yield);
                     } else {
                         server<utp::protocol>(ioc, endpoint, yield);
                     }
@@ -8,6 +8,15 @@
 #include <asio_utp.hpp>
 #include <namespaces.hpp>
 #include <boost/asio/spawn.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+#if defined(BOOST_ASIO_HAS_CO_AWAIT)
+#  include <boost/asio/co_spawn.hpp>
+#  include <boost/asio/detached.hpp>
+#  include <boost/asio/use_awaitable.hpp>
+#endif
 
 namespace sys = boost::system;
 namespace asio = boost::asio;
@@ -233,6 +242,1644 @@ BOOST_AUTO_TEST_CASE(comm_test2)
 }
 
 
+BOOST_AUTO_TEST_CASE(comm_cork)
+{
+    asio::io_context ioc;
+
+    utp::socket server_s(ioc);
+    utp::socket client_s(ioc);
+
+    {
+        sys::error_code ec1, ec2;
+
+        server_s.bind({ip::address_v4::loopback(), 0}, ec1);
+        client_s.bind({ip::address_v4::loopback(), 0}, ec2);
+
+        BOOST_REQUIRE(!ec1);
+        BOOST_REQUIRE(!ec2);
+    }
+
+    auto server_ep = server_s.local_endpoint();
+
+    size_t end_count = 2;
+
+    auto on_finish = [&] {
+        if (--end_count != 0) return;
+        client_s.close();
+        server_s.close();
+    };
+
+    asio::spawn(ioc, [&](asio::yield_context yield) {
+        sys::error_code ec;
+
+        server_s.async_accept(yield[ec]);
+        BOOST_REQUIRE(!ec);
+
+        string rx_msg(6, '\0');
+        asio::async_read(server_s, buffer(rx_msg), yield[ec]);
+        BOOST_REQUIRE(!ec);
+        BOOST_REQUIRE_EQUAL(rx_msg, "aabbcc");
+
+        // Uncorked, each of the writes would have gone out on its own.
+        auto stats = server_s.get_context_stats(ec);
+        BOOST_REQUIRE(!ec);
+        BOOST_REQUIRE_LT(stats.data_packets_received, 3u);
+
+        on_finish();
+    });
+
+    asio::spawn(ioc, [&](asio::yield_context yield) {
+        sys::error_code ec;
+
+        client_s.async_connect(server_ep, yield[ec]);
+        BOOST_REQUIRE(!ec);
+
+        client_s.set_option(utp::cork(true), ec);
+        BOOST_REQUIRE(!ec);
+
+        for (string tx_msg : {"aa", "bb", "cc"}) {
+            size_t n = client_s.async_write_some(asio::buffer(tx_msg), yield[ec]);
+            BOOST_REQUIRE(!ec);
+            BOOST_REQUIRE_EQUAL(n, tx_msg.size());
+        }
+
+        client_s.set_option(utp::cork(false), ec);
+        BOOST_REQUIRE(!ec);
+
+        on_finish();
+    });
+
+    ioc.run();
+
+    BOOST_REQUIRE_EQUAL(end_count, size_t(0));
+}
+
+
+// Without uncorking or flushing, the held back writes go out once the delay
+// is over.
+BOOST_AUTO_TEST_CASE(comm_coalesce_delay)
+{
+    asio::io_context ioc;
+
+    utp::socket server_s(ioc);
+    utp::socket client_s(ioc);
+
+    {
+        sys::error_code ec1, ec2;
+
+        server_s.bind({ip::address_v4::loopback(), 0}, ec1);
+        client_s.bind({ip::address_v4::loopback(), 0}, ec2);
+
+        BOOST_REQUIRE(!ec1);
+        BOOST_REQUIRE(!ec2);
+    }
+
+    auto server_ep = server_s.local_endpoint();
+
+    auto delay = chrono::milliseconds(50);
+    chrono::steady_clock::time_point written;
+
+    asio::spawn(ioc, [&](asio::yield_context yield) {
+        sys::error_code ec;
+
+        server_s.async_accept(yield[ec]);
+        BOOST_REQUIRE(!ec);
+
+        string rx_msg(6, '\0');
+        asio::async_read(server_s, buffer(rx_msg), yield[ec]);
+        BOOST_REQUIRE(!ec);
+        BOOST_REQUIRE_EQUAL(rx_msg, "aabbcc");
+
+        BOOST_REQUIRE(chrono::steady_clock::now() - written >= delay);
+
+        auto stats = server_s.get_context_stats(ec);
+        BOOST_REQUIRE(!ec);
+        BOOST_REQUIRE_LT(stats.data_packets_received, 3u);
+
+        client_s.close();
+        server_s.close();
+    });
+
+    asio::spawn(ioc, [&](asio::yield_context yield) {
+        sys::error_code ec;
+
+        client_s.async_connect(server_ep, yield[ec]);
+        BOOST_REQUIRE(!ec);
+
+        client_s.set_option(utp::coalesce_delay(delay), ec);
+        BOOST_REQUIRE(!ec);
+
+        written = chrono::steady_clock::now();
+
+        for (string tx_msg : {"aa", "bb", "cc"}) {
+            size_t n = client_s.async_write_some(asio::buffer(tx_msg), yield[ec]);
+            BOOST_REQUIRE(!ec);
+            BOOST_REQUIRE_EQUAL(n, tx_msg.size());
+        }
+    });
+
+    ioc.run();
+}
+
+
+BOOST_AUTO_TEST_CASE(comm_wait_and_read_some)
+{
+    asio::io_context ioc;
+
+    utp::socket server_s(ioc);
+    utp::socket client_s(ioc);
+
+    {
+        sys::error_code ec1, ec2;
+
+        server_s.bind({ip::address_v4::loopback(), 0}, ec1);
+        client_s.bind({ip::address_v4::loopback(), 0}, ec2);
+
+        BOOST_REQUIRE(!ec1);
+        BOOST_REQUIRE(!ec2);
+    }
+
+    auto server_ep = server_s.local_endpoint();
+
+    size_t end_count = 2;
+
+    auto on_finish = [&] {
+        if (--end_count != 0) return;
+        client_s.close();
+        server_s.close();
+    };
+
+    string tx_msg = "hello from client";
+
+    asio::spawn(ioc, [&](asio::yield_context yield) {
+        sys::error_code ec;
+
+        server_s.async_accept(yield[ec]);
+        BOOST_REQUIRE(!ec);
+
+        string rx_msg;
+
+        while (rx_msg.size() < tx_msg.size()) {
+            server_s.async_wait(asio::socket_base::wait_read, yield[ec]);
+            BOOST_REQUIRE(!ec);
+
+            BOOST_REQUIRE(server_s.available(ec) > 0);
+
+            while (true) {
+                char buf[4];
+                size_t n = server_s.read_some(asio::buffer(buf), ec);
+                if (ec == asio::error::would_block) break;
+                BOOST_REQUIRE(!ec);
+                rx_msg.append(buf, n);
+            }
+        }
+
+        BOOST_REQUIRE_EQUAL(rx_msg, tx_msg);
+
+        on_finish();
+    });
+
+    asio::spawn(ioc, [&](asio::yield_context yield) {
+        sys::error_code ec;
+
+        client_s.async_connect(server_ep, yield[ec]);
+        BOOST_REQUIRE(!ec);
+
+        client_s.async_wait(asio::socket_base::wait_write, yield[ec]);
+        BOOST_REQUIRE(!ec);
+
+        size_t n = client_s.write_some(asio::buffer(tx_msg), ec);
+        BOOST_REQUIRE(!ec);
+        BOOST_REQUIRE_EQUAL(n, tx_msg.size());
+
+        on_finish();
+    });
+
+    ioc.run();
+
+    BOOST_REQUIRE_EQUAL(end_count, size_t(0));
+}
+
+
+BOOST_AUTO_TEST_CASE(comm_immediate_completion)
+{
+    asio::io_context ioc;
+
+    utp::socket server_s(ioc);
+    utp::socket client_s(ioc);
+
+    {
+        sys::error_code ec1, ec2;
+
+        server_s.bind({ip::address_v4::loopback(), 0}, ec1);
+        client_s.bind({ip::address_v4::loopback(), 0}, ec2);
+
+        BOOST_REQUIRE(!ec1);
+        BOOST_REQUIRE(!ec2);
+    }
+
+    auto server_ep = server_s.local_endpoint();
+
+    string tx_msg(200, '\0');
+    for (size_t i = 0; i < tx_msg.size(); ++i) tx_msg[i] = 'a' + i % 26;
+
+    asio::spawn(ioc, [&](asio::yield_context yield) {
+        sys::error_code ec;
+
+        server_s.async_accept(yield[ec]);
+        BOOST_REQUIRE(!ec);
+
+        server_s.async_write_all(asio::buffer(tx_msg), yield[ec]);
+        BOOST_REQUIRE(!ec);
+    });
+
+    asio::spawn(ioc, [&](asio::yield_context yield) {
+        sys::error_code ec;
+
+        client_s.async_connect(server_ep, yield[ec]);
+        BOOST_REQUIRE(!ec);
+
+        client_s.set_option(utp::immediate_completion(true), ec);
+        BOOST_REQUIRE(!ec);
+
+        asio::steady_timer timer(ioc);
+
+        while (client_s.available(ec) < tx_msg.size()) {
+            timer.expires_after(chrono::milliseconds(10));
+            timer.async_wait(yield[ec]);
+        }
+
+        // One byte at a time, each handler starting the next read.
+        string rx_msg;
+        char c;
+        size_t depth = 0, max_depth = 0;
+        function<void()> read_one;
+
+        read_one = [&] {
+            client_s.async_read_some(asio::buffer(&c, 1),
+                [&] (const sys::error_code& ec, size_t n) {
+                    BOOST_REQUIRE(!ec);
+                    rx_msg.append(&c, n);
+                    max_depth = max(max_depth, ++depth);
+                    if (rx_msg.size() < tx_msg.size()) read_one();
+                    --depth;
+                });
+        };
+
+        read_one();
+
+        // The first handlers ran before `async_read_some` returned.
+        BOOST_REQUIRE(!rx_msg.empty());
+
+        while (rx_msg.size() < tx_msg.size()) {
+            timer.expires_after(chrono::milliseconds(10));
+            timer.async_wait(yield[ec]);
+        }
+
+        BOOST_REQUIRE_EQUAL(rx_msg, tx_msg);
+
+        // But they didn't all nest on the stack.
+        BOOST_REQUIRE(max_depth > 1);
+        BOOST_REQUIRE(max_depth < tx_msg.size());
+
+        client_s.close();
+        server_s.close();
+    });
+
+    ioc.run();
+}
+
+
+BOOST_AUTO_TEST_CASE(comm_on_data)
+{
+    asio::io_context ioc;
+
+    utp::socket server_s(ioc);
+    utp::socket client_s(ioc);
+
+    {
+        sys::error_code ec1, ec2;
+
+        server_s.bind({ip::address_v4::loopback(), 0}, ec1);
+        client_s.bind({ip::address_v4::loopback(), 0}, ec2);
+
+        BOOST_REQUIRE(!ec1);
+        BOOST_REQUIRE(!ec2);
+    }
+
+    auto server_ep = server_s.local_endpoint();
+
+    string tx_msg = "hello from client";
+    string rx_msg;
+
+    server_s.on_data([&] (const sys::error_code& ec, asio::const_buffer b) {
+        BOOST_REQUIRE(!ec);
+
+        // Take at most one byte at a time, the rest must be offered again.
+        size_t n = std::min<size_t>(b.size(), 1);
+        rx_msg.append(static_cast<const char*>(b.data()), n);
+        return n;
+    });
+
+    asio::spawn(ioc, [&](asio::yield_context yield) {
+        sys::error_code ec;
+
+        server_s.async_accept(yield[ec]);
+        BOOST_REQUIRE(!ec);
+
+        // Whatever the handler didn't take is readable the usual way.
+        while (rx_msg.size() < tx_msg.size()) {
+            server_s.async_wait(asio::socket_base::wait_read, yield[ec]);
+            if (ec) break;
+
+            char buf[64];
+            size_t n = server_s.read_some(asio::buffer(buf), ec);
+            if (ec == asio::error::would_block) continue;
+            BOOST_REQUIRE(!ec);
+            rx_msg.append(buf, n);
+        }
+
+        server_s.close();
+        client_s.close();
+    });
+
+    asio::spawn(ioc, [&](asio::yield_context yield) {
+        sys::error_code ec;
+
+        client_s.async_connect(server_ep, yield[ec]);
+        BOOST_REQUIRE(!ec);
+
+        client_s.async_write_some(asio::buffer(tx_msg), yield[ec]);
+        BOOST_REQUIRE(!ec);
+    });
+
+    ioc.run();
+
+    BOOST_REQUIRE_EQUAL(rx_msg, tx_msg);
+}
+
+
+BOOST_AUTO_TEST_CASE(comm_receive_chunks)
+{
+    asio::io_context ioc;
+
+    utp::socket server_s(ioc);
+    utp::socket client_s(ioc);
+
+    {
+        sys::error_code ec1, ec2;
+
+        server_s.bind({ip::address_v4::loopback(), 0}, ec1);
+        client_s.bind({ip::address_v4::loopback(), 0}, ec2);
+
+        BOOST_REQUIRE(!ec1);
+        BOOST_REQUIRE(!ec2);
+    }
+
+    auto server_ep = server_s.local_endpoint();
+
+    string tx_msg(5000, 'x');
+
+    asio::spawn(ioc, [&](asio::yield_context yield) {
+        sys::error_code ec;
+
+        server_s.async_accept(yield[ec]);
+        BOOST_REQUIRE(!ec);
+
+        string rx_msg;
+
+        while (rx_msg.size() < tx_msg.size()) {
+            auto chunks = server_s.async_receive_chunks(yield[ec]);
+            BOOST_REQUIRE(!ec);
+            BOOST_REQUIRE(!chunks.empty());
+
+            for (auto& c : chunks) {
+                rx_msg.append(reinterpret_cast<const char*>(c.data()), c.size());
+            }
+        }
+
+        BOOST_REQUIRE_EQUAL(rx_msg, tx_msg);
+
+        server_s.close();
+        client_s.close();
+    });
+
+    asio::spawn(ioc, [&](asio::yield_context yield) {
+        sys::error_code ec;
+
+        client_s.async_connect(server_ep, yield[ec]);
+        BOOST_REQUIRE(!ec);
+
+        asio::async_write(client_s, asio::buffer(tx_msg), yield[ec]);
+        BOOST_REQUIRE(!ec);
+    });
+
+    ioc.run();
+}
+
+
+BOOST_AUTO_TEST_CASE(comm_receive_provided)
+{
+    asio::io_context ioc;
+
+    utp::socket server_s(ioc);
+    utp::socket client_s(ioc);
+
+    {
+        sys::error_code ec1, ec2;
+
+        server_s.bind({ip::address_v4::loopback(), 0}, ec1);
+        client_s.bind({ip::address_v4::loopback(), 0}, ec2);
+
+        BOOST_REQUIRE(!ec1);
+        BOOST_REQUIRE(!ec2);
+    }
+
+    auto server_ep = server_s.local_endpoint();
+
+    string tx_msg(10000, 'x');
+    std::array<std::array<char, 1024>, 2> storage;
+
+    asio::spawn(ioc, [&](asio::yield_context yield) {
+        sys::error_code ec;
+
+        server_s.provide_buffers
+            ( std::array<asio::mutable_buffer, 2>{ asio::buffer(storage[0])
+                                                 , asio::buffer(storage[1]) }
+            , ec);
+        BOOST_REQUIRE(!ec);
+
+        server_s.async_accept(yield[ec]);
+        BOOST_REQUIRE(!ec);
+
+        string rx_msg;
+
+        while (rx_msg.size() < tx_msg.size()) {
+            auto b = server_s.async_receive_provided(yield[ec]);
+            BOOST_REQUIRE(!ec);
+
+            size_t i = b.index, n = b.size;
+            BOOST_REQUIRE(i < storage.size());
+            BOOST_REQUIRE(0 < n && n <= storage[i].size());
+
+            rx_msg.append(storage[i].data(), n);
+
+            server_s.recycle_buffer(i, ec);
+            BOOST_REQUIRE(!ec);
+
+            // The socket has it already.
+            server_s.recycle_buffer(i, ec);
+            BOOST_REQUIRE_EQUAL(ec, asio::error::invalid_argument);
+            ec = {};
+        }
+
+        BOOST_REQUIRE_EQUAL(rx_msg, tx_msg);
+
+        server_s.close();
+        client_s.close();
+    });
+
+    asio::spawn(ioc, [&](asio::yield_context yield) {
+        sys::error_code ec;
+
+        client_s.async_connect(server_ep, yield[ec]);
+        BOOST_REQUIRE(!ec);
+
+        asio::async_write(client_s, asio::buffer(tx_msg), yield[ec]);
+        BOOST_REQUIRE(!ec);
+    });
+
+    ioc.run();
+}
+
+
+BOOST_AUTO_TEST_CASE(comm_concrete_executor)
+{
+    using executor_type = asio::io_context::executor_type;
+    using socket_type = utp::basic_socket<executor_type>;
+
+    asio::io_context ioc;
+
+    socket_type server_s(ioc);
+    socket_type client_s(ioc.get_executor());
+
+    {
+        sys::error_code ec1, ec2;
+
+        server_s.bind({ip::address_v4::loopback(), 0}, ec1);
+        client_s.bind({ip::address_v4::loopback(), 0}, ec2);
+
+        BOOST_REQUIRE(!ec1);
+        BOOST_REQUIRE(!ec2);
+    }
+
+    string tx_msg = "hello";
+    string rx_msg(tx_msg.size(), '\0');
+
+    bool received = false;
+
+    server_s.async_accept([&] (sys::error_code ec) {
+        BOOST_REQUIRE(!ec);
+
+        asio::async_read(server_s, asio::buffer(&rx_msg[0], rx_msg.size()),
+            [&] (sys::error_code ec, size_t) {
+                BOOST_REQUIRE(!ec);
+                received = true;
+                server_s.close();
+                client_s.close();
+            });
+    });
+
+    client_s.async_connect(server_s.local_endpoint(), [&] (sys::error_code ec) {
+        BOOST_REQUIRE(!ec);
+
+        asio::async_write(client_s, asio::buffer(tx_msg),
+            [&] (sys::error_code ec, size_t) {
+                BOOST_REQUIRE(!ec);
+            });
+    });
+
+    ioc.run();
+
+    BOOST_REQUIRE(received);
+    BOOST_REQUIRE_EQUAL(rx_msg, tx_msg);
+}
+
+
+#if defined(BOOST_ASIO_HAS_CO_AWAIT)
+BOOST_AUTO_TEST_CASE(comm_awaitable)
+{
+    using asio::use_awaitable;
+
+    asio::io_context ioc;
+
+    utp::socket server_s(ioc);
+    utp::socket client_s(ioc);
+
+    {
+        sys::error_code ec1, ec2;
+
+        server_s.bind({ip::address_v4::loopback(), 0}, ec1);
+        client_s.bind({ip::address_v4::loopback(), 0}, ec2);
+
+        BOOST_REQUIRE(!ec1);
+        BOOST_REQUIRE(!ec2);
+    }
+
+    auto server_ep = server_s.local_endpoint();
+
+    string tx_msg = "hello";
+    string rx_msg(tx_msg.size(), '\0');
+
+    asio::co_spawn(ioc, [&] () -> asio::awaitable<void> {
+        co_await server_s.async_accept(use_awaitable);
+        co_await asio::async_read( server_s
+                                 , asio::buffer(&rx_msg[0], rx_msg.size())
+                                 , use_awaitable);
+        server_s.close();
+        client_s.close();
+    }, asio::detached);
+
+    asio::co_spawn(ioc, [&] () -> asio::awaitable<void> {
+        co_await client_s.async_connect(server_ep, use_awaitable);
+        co_await asio::async_write(client_s, asio::buffer(tx_msg), use_awaitable);
+    }, asio::detached);
+
+    ioc.run();
+
+    BOOST_REQUIRE_EQUAL(rx_msg, tx_msg);
+}
+#endif // BOOST_ASIO_HAS_CO_AWAIT
+
+
+BOOST_AUTO_TEST_CASE(comm_read_exactly_write_all)
+{
+    asio::io_context ioc;
+
+    utp::socket server_s(ioc);
+    utp::socket client_s(ioc);
+
+    {
+        sys::error_code ec1, ec2;
+
+        server_s.bind({ip::address_v4::loopback(), 0}, ec1);
+        client_s.bind({ip::address_v4::loopback(), 0}, ec2);
+
+        BOOST_REQUIRE(!ec1);
+        BOOST_REQUIRE(!ec2);
+    }
+
+    auto server_ep = server_s.local_endpoint();
+
+    string tx_msg(200 * 1000, '\0');
+
+    for (size_t i = 0; i < tx_msg.size(); ++i) tx_msg[i] = char(i % 251);
+
+    asio::spawn(ioc, [&](asio::yield_context yield) {
+        sys::error_code ec;
+
+        server_s.async_accept(yield[ec]);
+        BOOST_REQUIRE(!ec);
+
+        string rx_msg(tx_msg.size(), '\0');
+
+        size_t n = server_s.async_read_exactly
+            (asio::buffer(&rx_msg[0], rx_msg.size()), yield[ec]);
+
+        BOOST_REQUIRE(!ec);
+        BOOST_REQUIRE_EQUAL(n, tx_msg.size());
+        BOOST_REQUIRE(rx_msg == tx_msg);
+
+        server_s.close();
+        client_s.close();
+    });
+
+    asio::spawn(ioc, [&](asio::yield_context yield) {
+        sys::error_code ec;
+
+        client_s.async_connect(server_ep, yield[ec]);
+        BOOST_REQUIRE(!ec);
+
+        size_t n = client_s.async_write_all(asio::buffer(tx_msg), yield[ec]);
+
+        BOOST_REQUIRE(!ec);
+        BOOST_REQUIRE_EQUAL(n, tx_msg.size());
+    });
+
+    ioc.run();
+}
+
+
+BOOST_AUTO_TEST_CASE(comm_messages)
+{
+    asio::io_context ioc;
+
+    utp::socket server_s(ioc);
+    utp::socket client_s(ioc);
+
+    {
+        sys::error_code ec1, ec2;
+
+        server_s.bind({ip::address_v4::loopback(), 0}, ec1);
+        client_s.bind({ip::address_v4::loopback(), 0}, ec2);
+
+        BOOST_REQUIRE(!ec1);
+        BOOST_REQUIRE(!ec2);
+    }
+
+    auto server_ep = server_s.local_endpoint();
+
+    vector<string> tx_msgs = { "a", "", string(3000, 'b'), "cd"
+                             , string(2 * 1000 * 1000, 'e') };
+
+    asio::spawn(ioc, [&](asio::yield_context yield) {
+        sys::error_code ec;
+
+        server_s.async_accept(yield[ec]);
+        BOOST_REQUIRE(!ec);
+
+        for (auto& tx_msg : tx_msgs) {
+            auto rx_msg = server_s.async_receive_message(yield[ec]);
+            BOOST_REQUIRE(!ec);
+            BOOST_REQUIRE(string(rx_msg.begin(), rx_msg.end()) == tx_msg);
+        }
+
+        server_s.close();
+        client_s.close();
+    });
+
+    asio::spawn(ioc, [&](asio::yield_context yield) {
+        sys::error_code ec;
+
+        client_s.async_connect(server_ep, yield[ec]);
+        BOOST_REQUIRE(!ec);
+
+        for (auto& tx_msg : tx_msgs) {
+            size_t n = client_s.async_send_message(asio::buffer(tx_msg), yield[ec]);
+            BOOST_REQUIRE(!ec);
+            BOOST_REQUIRE_EQUAL(n, tx_msg.size());
+        }
+    });
+
+    ioc.run();
+}
+
+
+BOOST_AUTO_TEST_CASE(comm_stream_multiplexer)
+{
+    asio::io_context ioc;
+
+    utp::socket server_s(ioc);
+    utp::socket client_s(ioc);
+
+    {
+        sys::error_code ec1, ec2;
+
+        server_s.bind({ip::address_v4::loopback(), 0}, ec1);
+        client_s.bind({ip::address_v4::loopback(), 0}, ec2);
+
+        BOOST_REQUIRE(!ec1);
+        BOOST_REQUIRE(!ec2);
+    }
+
+    auto server_ep = server_s.local_endpoint();
+
+    // Larger than the per stream window.
+    vector<string> tx_msgs = { string(1000 * 1000, 'a')
+                             , string(1000 * 1000, 'b') };
+
+    unique_ptr<utp::stream_multiplexer> server_m, client_m;
+
+    size_t end_count = tx_msgs.size();
+
+    auto on_finish = [&] {
+        if (--end_count != 0) return;
+        server_m->close();
+        client_m->close();
+    };
+
+    asio::spawn(ioc, [&](asio::yield_context yield) {
+        sys::error_code ec;
+
+        server_s.async_accept(yield[ec]);
+        BOOST_REQUIRE(!ec);
+
+        server_m.reset(new utp::stream_multiplexer
+                ( move(server_s)
+                , utp::stream_multiplexer::role::server));
+
+        for (size_t i = 0; i < tx_msgs.size(); ++i) {
+            auto s = server_m->async_accept_stream(yield[ec]);
+            BOOST_REQUIRE(!ec);
+
+            asio::spawn(yield, [&, s = move(s)] (asio::yield_context yield) mutable {
+                sys::error_code ec;
+                string rx_msg;
+                auto b = asio::dynamic_buffer(rx_msg);
+                asio::async_read(s, b, yield[ec]);
+                BOOST_REQUIRE_EQUAL(ec, asio::error::connection_reset);
+
+                auto& tx_msg = tx_msgs[rx_msg.empty() ? 0 : rx_msg[0] - 'a'];
+                BOOST_REQUIRE(rx_msg == tx_msg);
+                on_finish();
+            });
+        }
+    });
+
+    asio::spawn(ioc, [&](asio::yield_context yield) {
+        sys::error_code ec;
+
+        client_s.async_connect(server_ep, yield[ec]);
+        BOOST_REQUIRE(!ec);
+
+        client_m.reset(new utp::stream_multiplexer
+                ( move(client_s)
+                , utp::stream_multiplexer::role::client));
+
+        for (auto& tx_msg : tx_msgs) {
+            auto s = client_m->open_stream(ec);
+            BOOST_REQUIRE(!ec);
+
+            asio::spawn(yield, [&, s = move(s)] (asio::yield_context yield) mutable {
+                sys::error_code ec;
+                asio::async_write(s, asio::buffer(tx_msg), yield[ec]);
+                BOOST_REQUIRE(!ec);
+                s.close();
+            });
+        }
+    });
+
+    ioc.run();
+}
+
+
+BOOST_AUTO_TEST_CASE(comm_datagrams)
+{
+    asio::io_context ioc;
+
+    utp::socket server_s(ioc);
+    utp::socket client_s(ioc);
+
+    {
+        sys::error_code ec1, ec2;
+
+        server_s.bind({ip::address_v4::loopback(), 0}, ec1);
+        client_s.bind({ip::address_v4::loopback(), 0}, ec2);
+
+        BOOST_REQUIRE(!ec1);
+        BOOST_REQUIRE(!ec2);
+    }
+
+    auto server_ep = server_s.local_endpoint();
+
+    vector<string> tx_msgs = { "a", "bc", string(utp::socket::max_datagram_size, 'd') };
+
+    asio::spawn(ioc, [&](asio::yield_context yield) {
+        sys::error_code ec;
+
+        server_s.async_accept(yield[ec]);
+        BOOST_REQUIRE(!ec);
+
+        for (auto& tx_msg : tx_msgs) {
+            string rx_msg(utp::socket::max_datagram_size, '\0');
+            size_t n = server_s.async_receive_datagram(buffer(rx_msg), yield[ec]);
+            BOOST_REQUIRE(!ec);
+            rx_msg.resize(n);
+            BOOST_REQUIRE(rx_msg == tx_msg);
+        }
+
+        server_s.close();
+        client_s.close();
+    });
+
+    asio::spawn(ioc, [&](asio::yield_context yield) {
+        sys::error_code ec;
+
+        client_s.async_connect(server_ep, yield[ec]);
+        BOOST_REQUIRE(!ec);
+
+        string too_big(utp::socket::max_datagram_size + 1, 'x');
+        client_s.async_send_datagram(asio::buffer(too_big), yield[ec]);
+        BOOST_REQUIRE_EQUAL(ec, asio::error::message_size);
+
+        for (auto& tx_msg : tx_msgs) {
+            size_t n = client_s.async_send_datagram(asio::buffer(tx_msg), yield[ec]);
+            BOOST_REQUIRE(!ec);
+            BOOST_REQUIRE_EQUAL(n, tx_msg.size());
+        }
+    });
+
+    ioc.run();
+}
+
+
+BOOST_AUTO_TEST_CASE(comm_connect_with_data)
+{
+    asio::io_context ioc;
+
+    utp::socket server_s(ioc);
+    utp::socket client_s(ioc);
+
+    {
+        sys::error_code ec1, ec2;
+
+        server_s.bind({ip::address_v4::loopback(), 0}, ec1);
+        client_s.bind({ip::address_v4::loopback(), 0}, ec2);
+
+        BOOST_REQUIRE(!ec1);
+        BOOST_REQUIRE(!ec2);
+    }
+
+    auto server_ep = server_s.local_endpoint();
+
+    string request = "request";
+    string response = "response";
+
+    asio::spawn(ioc, [&](asio::yield_context yield) {
+        sys::error_code ec;
+
+        server_s.async_accept(yield[ec]);
+        BOOST_REQUIRE(!ec);
+
+        // Issued before anything was received, completes once the request
+        // arrives.
+        server_s.async_write_all(asio::buffer(response), yield[ec]);
+        BOOST_REQUIRE(!ec);
+
+        string rx_msg(request.size(), '\0');
+        server_s.async_read_exactly(buffer(rx_msg), yield[ec]);
+        BOOST_REQUIRE(!ec);
+        BOOST_REQUIRE_EQUAL(rx_msg, request);
+    });
+
+    asio::spawn(ioc, [&](asio::yield_context yield) {
+        sys::error_code ec;
+
+        size_t n = client_s.async_connect(server_ep, asio::buffer(request), yield[ec]);
+        BOOST_REQUIRE(!ec);
+        BOOST_REQUIRE_EQUAL(n, request.size());
+
+        string rx_msg(response.size(), '\0');
+        client_s.async_read_exactly(buffer(rx_msg), yield[ec]);
+        BOOST_REQUIRE(!ec);
+        BOOST_REQUIRE_EQUAL(rx_msg, response);
+
+        server_s.close();
+        client_s.close();
+    });
+
+    ioc.run();
+}
+
+
+BOOST_AUTO_TEST_CASE(comm_server_first)
+{
+    asio::io_context ioc;
+
+    utp::socket server_s(ioc);
+    utp::socket client_s(ioc);
+
+    {
+        sys::error_code ec1, ec2;
+
+        server_s.bind({ip::address_v4::loopback(), 0}, ec1);
+        client_s.bind({ip::address_v4::loopback(), 0}, ec2);
+
+        BOOST_REQUIRE(!ec1);
+        BOOST_REQUIRE(!ec2);
+
+        server_s.set_option(utp::server_first(true), ec1);
+        client_s.set_option(utp::server_first(true), ec2);
+
+        BOOST_REQUIRE(!ec1);
+        BOOST_REQUIRE(!ec2);
+    }
+
+    auto server_ep = server_s.local_endpoint();
+
+    string banner = "banner";
+    string reply = "reply";
+
+    asio::spawn(ioc, [&](asio::yield_context yield) {
+        sys::error_code ec;
+
+        server_s.async_accept(yield[ec]);
+        BOOST_REQUIRE(!ec);
+
+        server_s.async_write_all(asio::buffer(banner), yield[ec]);
+        BOOST_REQUIRE(!ec);
+
+        string rx_msg(reply.size(), '\0');
+        server_s.async_read_exactly(buffer(rx_msg), yield[ec]);
+        BOOST_REQUIRE(!ec);
+        BOOST_REQUIRE_EQUAL(rx_msg, reply);
+
+        server_s.close();
+        client_s.close();
+    });
+
+    asio::spawn(ioc, [&](asio::yield_context yield) {
+        sys::error_code ec;
+
+        client_s.async_connect(server_ep, yield[ec]);
+        BOOST_REQUIRE(!ec);
+
+        // Nothing written by the application before the banner arrives.
+        string rx_msg(banner.size(), '\0');
+        client_s.async_read_exactly(buffer(rx_msg), yield[ec]);
+        BOOST_REQUIRE(!ec);
+        BOOST_REQUIRE_EQUAL(rx_msg, banner);
+
+        client_s.async_write_all(asio::buffer(reply), yield[ec]);
+        BOOST_REQUIRE(!ec);
+    });
+
+    ioc.run();
+}
+
+
+BOOST_AUTO_TEST_CASE(comm_connection_pool)
+{
+    asio::io_context ioc;
+
+    utp::socket server_s(ioc);
+    utp::connection_pool pool(ioc.get_executor());
+
+    {
+        sys::error_code ec1, ec2;
+
+        server_s.bind({ip::address_v4::loopback(), 0}, ec1);
+        pool.bind({ip::address_v4::loopback(), 0}, ec2);
+
+        BOOST_REQUIRE(!ec1);
+        BOOST_REQUIRE(!ec2);
+    }
+
+    auto server_ep = server_s.local_endpoint();
+
+    asio::spawn(ioc, [&](asio::yield_context yield) {
+        sys::error_code ec;
+
+        server_s.async_accept(yield[ec]);
+        BOOST_REQUIRE(!ec);
+
+        // Both requests come over the same connection.
+        string rx_msg(2, '\0');
+        server_s.async_read_exactly(buffer(rx_msg), yield[ec]);
+        BOOST_REQUIRE(!ec);
+        BOOST_REQUIRE_EQUAL(rx_msg, "ab");
+
+        server_s.close();
+        pool.close();
+    });
+
+    asio::spawn(ioc, [&](asio::yield_context yield) {
+        sys::error_code ec;
+
+        auto s1 = pool.async_get(server_ep, yield[ec]);
+        BOOST_REQUIRE(!ec);
+        auto impl = s1.pimpl();
+
+        s1.async_write_all(asio::buffer("a", 1), yield[ec]);
+        BOOST_REQUIRE(!ec);
+
+        pool.release(move(s1));
+        BOOST_REQUIRE_EQUAL(pool.idle_count(server_ep), 1u);
+
+        auto s2 = pool.async_get(server_ep, yield[ec]);
+        BOOST_REQUIRE(!ec);
+        BOOST_REQUIRE_EQUAL(s2.pimpl(), impl);
+        BOOST_REQUIRE_EQUAL(pool.idle_count(), 0u);
+
+        s2.async_write_all(asio::buffer("b", 1), yield[ec]);
+        BOOST_REQUIRE(!ec);
+    });
+
+    ioc.run();
+}
+
+
+// Connects to a peer that never answers end with the timeout, or when the
+// pool closes.
+BOOST_AUTO_TEST_CASE(comm_connection_pool_pending_connect)
+{
+    asio::io_context ioc;
+
+    utp::connection_pool::limits limits;
+    limits.connect_timeout = chrono::milliseconds(100);
+
+    utp::connection_pool timing_out(ioc.get_executor(), limits);
+    utp::connection_pool closing(ioc.get_executor());
+
+    udp::socket black_hole(ioc, {ip::address_v4::loopback(), 0});
+
+    {
+        sys::error_code ec1, ec2;
+
+        timing_out.bind({ip::address_v4::loopback(), 0}, ec1);
+        closing.bind({ip::address_v4::loopback(), 0}, ec2);
+
+        BOOST_REQUIRE(!ec1);
+        BOOST_REQUIRE(!ec2);
+    }
+
+    auto dead_ep = black_hole.local_endpoint();
+
+    asio::spawn(ioc, [&](asio::yield_context yield) {
+        sys::error_code ec;
+        timing_out.async_get(dead_ep, yield[ec]);
+        BOOST_REQUIRE_EQUAL(ec, asio::error::timed_out);
+    });
+
+    asio::spawn(ioc, [&](asio::yield_context yield) {
+        sys::error_code ec;
+        closing.async_get(dead_ep, yield[ec]);
+        BOOST_REQUIRE_EQUAL(ec, asio::error::operation_aborted);
+    });
+
+    asio::post(ioc, [&] { closing.close(); });
+
+    ioc.run();
+}
+
+
+BOOST_AUTO_TEST_CASE(comm_move_assign)
+{
+    asio::io_context ioc;
+
+    utp::socket server_s(ioc);
+    utp::socket client_s(ioc);
+
+    {
+        sys::error_code ec1, ec2;
+
+        server_s.bind({ip::address_v4::loopback(), 0}, ec1);
+        client_s.bind({ip::address_v4::loopback(), 0}, ec2);
+
+        BOOST_REQUIRE(!ec1);
+        BOOST_REQUIRE(!ec2);
+    }
+
+    auto server_ep = server_s.local_endpoint();
+
+    asio::spawn(ioc, [&](asio::yield_context yield) {
+        sys::error_code ec;
+
+        server_s.async_accept(yield[ec]);
+        BOOST_REQUIRE(!ec);
+
+        string rx_msg(1, '\0');
+        server_s.async_read_exactly(buffer(rx_msg), yield[ec]);
+        BOOST_REQUIRE(!ec);
+        BOOST_REQUIRE_EQUAL(rx_msg, "a");
+
+        // The moved to socket closed the connection when it got replaced.
+        server_s.async_read_some(buffer(rx_msg), yield[ec]);
+        BOOST_REQUIRE_EQUAL(ec, asio::error::connection_reset);
+    });
+
+    asio::spawn(ioc, [&](asio::yield_context yield) {
+        sys::error_code ec;
+
+        client_s.async_connect(server_ep, yield[ec]);
+        BOOST_REQUIRE(!ec);
+
+        utp::socket s(ioc);
+        s.bind({ip::address_v4::loopback(), 0}, ec);
+        BOOST_REQUIRE(!ec);
+
+        auto impl = client_s.pimpl();
+
+        s = move(client_s);
+
+        BOOST_REQUIRE_EQUAL(s.pimpl(), impl);
+        BOOST_REQUIRE(s.is_open());
+        BOOST_REQUIRE(!client_s.is_open());
+
+        s.async_write_all(asio::buffer("a", 1), yield[ec]);
+        BOOST_REQUIRE(!ec);
+
+        s = utp::socket(ioc);
+        BOOST_REQUIRE(!s.is_open());
+    });
+
+    ioc.run();
+}
+
+BOOST_AUTO_TEST_CASE(comm_connect_any)
+{
+    asio::io_context ioc;
+
+    utp::socket server_s(ioc);
+    utp::socket client_s(ioc);
+
+    // Never answers.
+    udp::socket black_hole(ioc, {ip::address_v4::loopback(), 0});
+
+    {
+        sys::error_code ec1, ec2;
+
+        server_s.bind({ip::address_v4::loopback(), 0}, ec1);
+        client_s.bind({ip::address_v4::loopback(), 0}, ec2);
+
+        BOOST_REQUIRE(!ec1);
+        BOOST_REQUIRE(!ec2);
+    }
+
+    auto server_ep = server_s.local_endpoint();
+
+    vector<udp::endpoint> candidates = { black_hole.local_endpoint(), server_ep };
+
+    asio::spawn(ioc, [&](asio::yield_context yield) {
+        sys::error_code ec;
+
+        server_s.async_accept(yield[ec]);
+        BOOST_REQUIRE(!ec);
+
+        string rx_msg(1, '\0');
+        server_s.async_read_exactly(buffer(rx_msg), yield[ec]);
+        BOOST_REQUIRE(!ec);
+
+        server_s.close();
+        client_s.close();
+    });
+
+    asio::spawn(ioc, [&](asio::yield_context yield) {
+        sys::error_code ec;
+
+        auto ep = utp::async_connect_any( client_s
+                                        , candidates
+                                        , chrono::milliseconds(50)
+                                        , yield[ec]);
+        BOOST_REQUIRE(!ec);
+        BOOST_REQUIRE_EQUAL(ep, server_ep);
+        BOOST_REQUIRE_EQUAL(client_s.remote_endpoint(), server_ep);
+
+        client_s.async_write_all(asio::buffer("x", 1), yield[ec]);
+        BOOST_REQUIRE(!ec);
+    });
+
+    ioc.run();
+}
+
+
+// The socket passed to `async_connect_any` may be moved or destroyed while
+// the operation is pending.
+BOOST_AUTO_TEST_CASE(comm_connect_any_target_gone)
+{
+    asio::io_context ioc;
+
+    utp::socket server_s(ioc);
+    utp::socket client_s(ioc);
+    utp::socket moved_to(ioc);
+    auto doomed = make_unique<utp::socket>(ioc);
+
+    udp::socket black_hole(ioc, {ip::address_v4::loopback(), 0});
+
+    {
+        sys::error_code ec1, ec2, ec3;
+
+        server_s.bind({ip::address_v4::loopback(), 0}, ec1);
+        client_s.bind({ip::address_v4::loopback(), 0}, ec2);
+        doomed->bind({ip::address_v4::loopback(), 0}, ec3);
+
+        BOOST_REQUIRE(!ec1);
+        BOOST_REQUIRE(!ec2);
+        BOOST_REQUIRE(!ec3);
+    }
+
+    auto server_ep = server_s.local_endpoint();
+
+    vector<udp::endpoint> candidates = { black_hole.local_endpoint(), server_ep };
+
+    asio::spawn(ioc, [&](asio::yield_context yield) {
+        sys::error_code ec;
+
+        server_s.async_accept(yield[ec]);
+        BOOST_REQUIRE(!ec);
+
+        string rx_msg(1, '\0');
+        server_s.async_read_exactly(buffer(rx_msg), yield[ec]);
+        BOOST_REQUIRE(!ec);
+
+        server_s.close();
+        moved_to.close();
+    });
+
+    asio::spawn(ioc, [&](asio::yield_context yield) {
+        sys::error_code ec;
+
+        utp::async_connect_any( client_s
+                              , candidates
+                              , chrono::milliseconds(50)
+                              , yield[ec]);
+        BOOST_REQUIRE(!ec);
+        BOOST_REQUIRE(!client_s.is_open());
+        BOOST_REQUIRE_EQUAL(moved_to.remote_endpoint(), server_ep);
+
+        moved_to.async_write_all(asio::buffer("x", 1), yield[ec]);
+        BOOST_REQUIRE(!ec);
+    });
+
+    asio::post(ioc, [&] { moved_to = move(client_s); });
+
+    bool aborted = false;
+
+    utp::async_connect_any( *doomed
+                          , vector<udp::endpoint>{ black_hole.local_endpoint() }
+                          , chrono::milliseconds(10)
+                          , [&] (const sys::error_code& ec, udp::endpoint) {
+                                BOOST_REQUIRE_EQUAL(ec, asio::error::operation_aborted);
+                                aborted = true;
+                            });
+
+    asio::post(ioc, [&] { doomed = nullptr; });
+
+    ioc.run();
+
+    BOOST_REQUIRE(aborted);
+}
+
+
+BOOST_AUTO_TEST_CASE(comm_path_metrics)
+{
+    asio::io_context ioc;
+
+    utp::socket server_s(ioc);
+    utp::socket client_s(ioc);
+
+    {
+        sys::error_code ec1, ec2;
+
+        server_s.bind({ip::address_v4::loopback(), 0}, ec1);
+        client_s.bind({ip::address_v4::loopback(), 0}, ec2);
+
+        BOOST_REQUIRE(!ec1);
+        BOOST_REQUIRE(!ec2);
+    }
+
+    auto server_ep = server_s.local_endpoint();
+
+    asio::spawn(ioc, [&](asio::yield_context yield) {
+        sys::error_code ec;
+        server_s.async_accept(yield[ec]);
+        BOOST_REQUIRE(!ec);
+    });
+
+    asio::spawn(ioc, [&](asio::yield_context yield) {
+        sys::error_code ec;
+
+        utp::path_metrics m;
+
+        BOOST_REQUIRE(!client_s.cached_path_metrics(server_ep.address(), m, ec));
+
+        client_s.async_connect(server_ep, yield[ec]);
+        BOOST_REQUIRE(!ec);
+
+        BOOST_REQUIRE(client_s.cached_path_metrics(server_ep.address(), m, ec));
+        BOOST_REQUIRE(!ec);
+
+        client_s.set_option(utp::path_metrics_expiry(chrono::seconds(0)), ec);
+        BOOST_REQUIRE(!ec);
+
+        asio::steady_timer timer(ioc);
+        timer.expires_after(chrono::milliseconds(1));
+        timer.async_wait(yield[ec]);
+
+        BOOST_REQUIRE(!client_s.cached_path_metrics(server_ep.address(), m, ec));
+
+        server_s.close();
+        client_s.close();
+    });
+
+    // A connection that never got anywhere leaves nothing behind.
+    asio::spawn(ioc, [&](asio::yield_context yield) {
+        sys::error_code ec;
+
+        udp::socket black_hole(ioc, {ip::address_v4::loopback(), 0});
+
+        utp::socket lost_s(ioc);
+        lost_s.bind({ip::address_v4::loopback(), 0}, ec);
+        BOOST_REQUIRE(!ec);
+
+        // Shares the context with `lost_s`.
+        utp::socket observer(ioc);
+        observer.bind(lost_s.local_endpoint(), ec);
+        BOOST_REQUIRE(!ec);
+
+        asio::steady_timer timer(ioc);
+        timer.expires_after(chrono::milliseconds(50));
+        timer.async_wait([&] (const sys::error_code&) { lost_s.close(); });
+
+        lost_s.async_connect(black_hole.local_endpoint(), yield[ec]);
+        BOOST_REQUIRE_EQUAL(ec, asio::error::operation_aborted);
+
+        utp::path_metrics m;
+        BOOST_REQUIRE(!observer.cached_path_metrics( black_hole.local_endpoint().address()
+                                                   , m
+                                                   , ec));
+        BOOST_REQUIRE(!ec);
+    });
+
+    ioc.run();
+}
+
+
+BOOST_AUTO_TEST_CASE(comm_utp_options)
+{
+    asio::io_context ioc;
+
+    utp::udp_multiplexer m(ioc);
+    utp::socket server_s(ioc);
+    utp::socket client_s(ioc);
+
+    {
+        sys::error_code ec1, ec2, ec3;
+
+        m.bind({ip::address_v4::loopback(), 0}, ec1);
+        server_s.bind({ip::address_v4::loopback(), 0}, ec2);
+        client_s.bind(m, ec3);
+
+        BOOST_REQUIRE(!ec1);
+        BOOST_REQUIRE(!ec2);
+        BOOST_REQUIRE(!ec3);
+    }
+
+    {
+        sys::error_code ec;
+
+        m.set_option(utp::target_delay(chrono::milliseconds(50)), ec);
+        BOOST_REQUIRE(!ec);
+
+        m.set_option(utp::send_buffer_size(0), ec);
+        BOOST_REQUIRE_EQUAL(ec, asio::error::invalid_argument);
+        ec = {};
+
+        client_s.set_option(utp::receive_buffer_size(64 * 1024), ec);
+        BOOST_REQUIRE(!ec);
+
+        m.set_option(asio::socket_base::receive_buffer_size(256 * 1024), ec);
+        BOOST_REQUIRE(!ec);
+
+        asio::socket_base::receive_buffer_size b;
+        m.get_option(b, ec);
+        BOOST_REQUIRE(!ec);
+        BOOST_REQUIRE(b.value() > 0);
+    }
+
+    auto check = [&] {
+        sys::error_code ec;
+
+        utp::target_delay d;
+        client_s.get_option(d, ec);
+        BOOST_REQUIRE(!ec);
+        BOOST_REQUIRE_EQUAL(d.value().count(), 50);
+
+        utp::receive_buffer_size b;
+        client_s.get_option(b, ec);
+        BOOST_REQUIRE(!ec);
+        BOOST_REQUIRE_EQUAL(b.value(), 64 * 1024);
+    };
+
+    // Before the connection exists and after.
+    check();
+
+    auto server_ep = server_s.local_endpoint();
+
+    asio::spawn(ioc, [&](asio::yield_context yield) {
+        sys::error_code ec;
+        server_s.async_accept(yield[ec]);
+        BOOST_REQUIRE(!ec);
+    });
+
+    asio::spawn(ioc, [&](asio::yield_context yield) {
+        sys::error_code ec;
+
+        client_s.async_connect(server_ep, yield[ec]);
+        BOOST_REQUIRE(!ec);
+
+        check();
+
+        // The large target controller overrides the target delay.
+        utp::target_delay d;
+
+        client_s.set_option(utp::congestion_control(
+                    utp::congestion_controller::ledbat_large_target), ec);
+        BOOST_REQUIRE(!ec);
+        client_s.get_option(d, ec);
+        BOOST_REQUIRE(d.value() > chrono::seconds(1));
+
+        client_s.set_option(utp::congestion_control(
+                    utp::congestion_controller::ledbat), ec);
+        BOOST_REQUIRE(!ec);
+        check();
+
+        server_s.close();
+        client_s.close();
+    });
+
+    ioc.run();
+}
+
+// Transfers some data and returns the receiving side's context stats.
+static utp::context_stats receiver_stats(size_t ack_frequency)
+{
+    asio::io_context ioc;
+
+    utp::socket server_s(ioc);
+    utp::socket client_s(ioc);
+
+    {
+        sys::error_code ec1, ec2;
+
+        server_s.bind({ip::address_v4::loopback(), 0}, ec1);
+        client_s.bind({ip::address_v4::loopback(), 0}, ec2);
+
+        BOOST_REQUIRE(!ec1);
+        BOOST_REQUIRE(!ec2);
+    }
+
+    if (ack_frequency) {
+        sys::error_code ec;
+        server_s.set_option(utp::ack_frequency(ack_frequency), ec);
+        BOOST_REQUIRE(!ec);
+    }
+
+    auto server_ep = server_s.local_endpoint();
+
+    const size_t size = 256 * 1024;
+
+    utp::context_stats stats;
+
+    asio::spawn(ioc, [&](asio::yield_context yield) {
+        sys::error_code ec;
+        server_s.async_accept(yield[ec]);
+        BOOST_REQUIRE(!ec);
+
+        vector<uint8_t> rx(size);
+        asio::async_read(server_s, asio::buffer(rx), yield[ec]);
+        BOOST_REQUIRE(!ec);
+
+        stats = server_s.get_context_stats(ec);
+        BOOST_REQUIRE(!ec);
+
+        server_s.close();
+        client_s.close();
+    });
+
+    asio::spawn(ioc, [&](asio::yield_context yield) {
+        sys::error_code ec;
+
+        client_s.async_connect(server_ep, yield[ec]);
+        BOOST_REQUIRE(!ec);
+
+        vector<uint8_t> tx(size, 'x');
+        asio::async_write(client_s, asio::buffer(tx), yield[ec]);
+        BOOST_REQUIRE(!ec);
+    });
+
+    ioc.run();
+
+    return stats;
+}
+
+BOOST_AUTO_TEST_CASE(comm_ack_frequency)
+{
+    {
+        asio::io_context ioc;
+        utp::socket s(ioc);
+        sys::error_code ec;
+
+        s.bind({ip::address_v4::loopback(), 0}, ec);
+        BOOST_REQUIRE(!ec);
+
+        s.set_option(utp::max_ack_delay(chrono::milliseconds(0)), ec);
+        BOOST_REQUIRE_EQUAL(ec, asio::error::invalid_argument);
+    }
+
+    auto dflt = receiver_stats(0);
+    auto sparse = receiver_stats(8);
+
+    BOOST_REQUIRE(dflt.data_packets_received > 0);
+    BOOST_REQUIRE(sparse.data_packets_received > 0);
+
+    // Acks per data packet.
+    BOOST_REQUIRE( float(sparse.acks_sent) / sparse.data_packets_received
+                 < float(dflt.acks_sent) / dflt.data_packets_received);
+}
+
+BOOST_AUTO_TEST_CASE(comm_forward_error_correction)
+{
+    asio::io_context ioc;
+
+    utp::socket server_s(ioc);
+    utp::socket client_s(ioc);
+
+    {
+        sys::error_code ec1, ec2;
+
+        server_s.bind({ip::address_v4::loopback(), 0}, ec1);
+        client_s.bind({ip::address_v4::loopback(), 0}, ec2);
+
+        BOOST_REQUIRE(!ec1);
+        BOOST_REQUIRE(!ec2);
+    }
+
+    {
+        sys::error_code ec;
+
+        client_s.set_option(utp::forward_error_correction(256), ec);
+        BOOST_REQUIRE_EQUAL(ec, asio::error::invalid_argument);
+        ec = {};
+
+        client_s.set_option(utp::forward_error_correction(4), ec);
+        BOOST_REQUIRE(!ec);
+        server_s.set_option(utp::forward_error_correction(4), ec);
+        BOOST_REQUIRE(!ec);
+    }
+
+    auto server_ep = server_s.local_endpoint();
+
+    vector<uint8_t> tx(256 * 1024);
+    for (size_t i = 0; i < tx.size(); ++i) tx[i] = i % 251;
+
+    asio::spawn(ioc, [&](asio::yield_context yield) {
+        sys::error_code ec;
+        server_s.async_accept(yield[ec]);
+        BOOST_REQUIRE(!ec);
+
+        vector<uint8_t> rx(tx.size());
+        asio::async_read(server_s, asio::buffer(rx), yield[ec]);
+        BOOST_REQUIRE(!ec);
+        BOOST_REQUIRE(rx == tx);
+
+        auto stats = client_s.get_context_stats(ec);
+        BOOST_REQUIRE(!ec);
+        BOOST_REQUIRE(stats.fec_parity_packets_sent > 0);
+
+        // Groups cut short hold at least two packets.
+        auto server_stats = server_s.get_context_stats(ec);
+        BOOST_REQUIRE(!ec);
+        BOOST_REQUIRE_LE( stats.fec_parity_packets_sent * 2
+                        , server_stats.data_packets_received);
+
+        server_s.close();
+        client_s.close();
+    });
+
+    asio::spawn(ioc, [&](asio::yield_context yield) {
+        sys::error_code ec;
+
+        client_s.async_connect(server_ep, yield[ec]);
+        BOOST_REQUIRE(!ec);
+
+        asio::async_write(client_s, asio::buffer(tx), yield[ec]);
+        BOOST_REQUIRE(!ec);
+    });
+
+    ioc.run();
+}
+
 BOOST_AUTO_TEST_CASE(socket_local_random_bind)
 {
     asio::io_context ioc;
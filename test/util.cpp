@@ -2,6 +2,7 @@
 #include <boost/test/included/unit_test.hpp>
 
 #include <util.hpp>
+#include <fec.hpp>
 #include <iostream>
 
 using namespace asio_utp;
@@ -37,4 +38,124 @@ BOOST_AUTO_TEST_CASE(sockaddr_conversion)
     }
 }
 
+BOOST_AUTO_TEST_CASE(fec_recovery)
+{
+    using detail::fec;
+
+    // Different lengths, so the padding and the length XOR matter.
+    vector<vector<uint8_t>> packets;
+
+    for (size_t i = 0; i < 5; ++i) {
+        vector<uint8_t> p(20 + i * 37);
+        for (auto& b : p) b = rand() % 256;
+        packets.push_back(move(p));
+    }
+
+    fec::peer tx;
+    vector<vector<uint8_t>> frames;
+
+    for (auto& p : packets) {
+        vector<uint8_t> frame;
+        fec::encode(tx, p.data(), p.size(), frame);
+        frames.push_back(move(frame));
+    }
+
+    vector<uint8_t> parity;
+    BOOST_REQUIRE(fec::take_parity(tx, parity));
+    BOOST_REQUIRE(!fec::take_parity(tx, parity));
+
+    for (size_t lost = 0; lost < packets.size(); ++lost) {
+        fec::peer rx;
+        vector<uint8_t> recovered;
+
+        // The parity frame may also come before the data.
+        bool parity_first = lost % 2;
+
+        if (parity_first) {
+            BOOST_REQUIRE(fec::decode_parity(rx, parity.data(), parity.size(), recovered));
+            BOOST_REQUIRE(recovered.empty());
+        }
+
+        for (size_t i = 0; i < frames.size(); ++i) {
+            if (i == lost) continue;
+
+            const uint8_t* packet;
+            size_t packet_size;
+
+            BOOST_REQUIRE(fec::decode_data( rx
+                                          , frames[i].data()
+                                          , frames[i].size()
+                                          , packet
+                                          , packet_size
+                                          , recovered));
+
+            BOOST_REQUIRE(vector<uint8_t>(packet, packet + packet_size) == packets[i]);
+        }
+
+        if (!parity_first) {
+            BOOST_REQUIRE(recovered.empty());
+            BOOST_REQUIRE(fec::decode_parity(rx, parity.data(), parity.size(), recovered));
+        }
+
+        BOOST_REQUIRE_EQUAL(recovered.size(), packets[lost].size());
+        BOOST_REQUIRE(recovered == packets[lost]);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(fec_limits)
+{
+    using detail::fec;
+
+    vector<uint8_t> recovered;
+    const uint8_t* packet;
+    size_t packet_size;
+
+    {
+        fec::peer rx;
+        vector<uint8_t> frame(fec::data_header_size + 20, 0);
+        frame[0] = fec::data_marker;
+        frame[3] = fec::max_group_size;
+
+        BOOST_REQUIRE(!fec::decode_data(rx, frame.data(), frame.size(), packet, packet_size, recovered));
+        BOOST_REQUIRE_EQUAL(rx.rx_bytes, 0u);
+    }
+
+    {
+        // Packets keep going through once a peer's groups hold all they may,
+        // and what they held is freed as they are given up on.
+        fec::peer rx;
+        vector<uint8_t> frame(fec::data_header_size + 60000, 0);
+        frame[0] = fec::data_marker;
+
+        for (uint16_t group = 0; group < 2 * fec::max_rx_groups; ++group) {
+            for (uint8_t index = 0; index < 4; ++index) {
+                frame[1] = group >> 8;
+                frame[2] = group & 0xff;
+                frame[3] = index;
+
+                BOOST_REQUIRE(fec::decode_data(rx, frame.data(), frame.size(), packet, packet_size, recovered));
+                BOOST_REQUIRE_EQUAL(packet_size, frame.size() - fec::data_header_size);
+                BOOST_REQUIRE(rx.rx_bytes <= fec::max_rx_peer_bytes);
+            }
+        }
+
+        BOOST_REQUIRE(recovered.empty());
+    }
+
+    {
+        fec f;
+
+        for (uint16_t port = 1; port <= fec::max_peers + 1; ++port) {
+            f.find_or_create({ip::address_v4::loopback(), port}).hello_sent = true;
+
+            // Keeps the first peer in use.
+            f.find_or_create({ip::address_v4::loopback(), 1});
+        }
+
+        BOOST_REQUIRE(f.find({ip::address_v4::loopback(), 1}));
+        BOOST_REQUIRE(!f.find({ip::address_v4::loopback(), 2}));
+        BOOST_REQUIRE(f.find({ip::address_v4::loopback(), fec::max_peers + 1}));
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()